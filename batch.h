@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <exception>
+#include <optional>
+#include <vector>
+#include "search.h"
+#include "testgen.h"
+#include "util.h"
+
+#ifndef BATCH_H
+#define BATCH_H
+
+namespace batch {
+
+template <typename State>
+class BatchResult {
+public:
+    // in the same order as the input test cases
+    const std::vector<search::SearchResult<State>> results;
+    const std::vector<double> latencies;
+    const double seconds_taken;
+
+    BatchResult(
+        const std::vector<search::SearchResult<State>>& results,
+        const std::vector<double>& latencies,
+        double seconds_taken
+    ) :
+        results(results),
+        latencies(latencies),
+        seconds_taken(seconds_taken)
+    { }
+
+    double problems_per_second() const {
+        return (double)results.size() / seconds_taken;
+    }
+
+    // p in [0, 1], e.g. 0.5 for the median latency
+    double latency_percentile(double p) const {
+        if (latencies.empty()) {
+            return 0;
+        }
+        std::vector<double> sorted = latencies;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[(std::size_t)(p * (double)(sorted.size() - 1))];
+    }
+};
+
+// Solves every test case with solve(test_case) on the threads of pool,
+// where solve returns a SearchResult<State>. All threads share the prebuilt
+// table, which must be constructed before calling this. If any solve
+// throws, the first exception is rethrown once every job has finished.
+template <typename State, typename Solve>
+BatchResult<State> plan(
+    const std::vector<knitting::TestCase>& test_cases, Solve solve, ThreadPool& pool
+) {
+    StopWatch stop_watch;
+    std::vector<std::optional<search::SearchResult<State>>> results(test_cases.size());
+    std::vector<double> latencies(test_cases.size());
+    std::vector<std::future<void>> done;
+
+    for (std::size_t i = 0; i < test_cases.size(); i++) {
+        done.push_back(pool.submit([&, i]() {
+            StopWatch latency;
+            results[i].emplace(solve(test_cases[i]));
+            latencies[i] = latency.stop();
+        }));
+    }
+    // the jobs refer to the locals above, so every one must finish before
+    // an exception from any of them leaves this scope
+    std::exception_ptr error;
+    for (auto& d : done) {
+        try {
+            d.get();
+        }
+        catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    std::vector<search::SearchResult<State>> ordered;
+    ordered.reserve(results.size());
+    for (auto& result : results) {
+        ordered.push_back(*result);
+    }
+
+    return BatchResult<State>(ordered, latencies, stop_watch.stop());
+}
+
+// Submits solve(test_case) for every test case to pool without waiting,
+// returning futures in the same order as the test cases, so that several
+// configurations can share the pool. test_cases must outlive the jobs,
+// e.g. by being declared before the pool.
+template <typename State, typename Solve>
+std::vector<std::future<search::SearchResult<State>>> submit(
+    const std::vector<knitting::TestCase>& test_cases, Solve solve, ThreadPool& pool
+) {
+    std::vector<std::future<search::SearchResult<State>>> results;
+    for (std::size_t i = 0; i < test_cases.size(); i++) {
+        results.push_back(pool.submit([&test_cases, solve, i]() {
+            return solve(test_cases[i]);
+        }));
+    }
+    return results;
+}
+
+template <typename State, typename Solve>
+BatchResult<State> plan(
+    const std::vector<knitting::TestCase>& test_cases, Solve solve, unsigned int threads
+) {
+    ThreadPool pool(threads);
+    return plan<State>(test_cases, solve, pool);
+}
+
+}
+
+#endif
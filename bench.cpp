@@ -0,0 +1,513 @@
+#include "external.h"
+#include "knitting.h"
+#include "heuristics.h"
+#include "prebuilt.h"
+#include "profile.h"
+#include "search.h"
+#include "testgen.h"
+#include "util.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace kn = knitting;
+
+class InvalidSuiteException { };
+
+// One benchmark suite, given as comma-separated key=value pairs, e.g.
+// "generator=simple_tube,width=10,loops=8,passes=3,seed=1". Keys not given
+// keep the defaults below.
+class Suite {
+public:
+    std::string name;
+    std::map<std::string, std::string> values {
+        { "generator", "flat_lace" },  // flat_lace, simple_tube or flat_lace_panel
+        { "width", "7" },
+        { "min_racking", "-5" },
+        { "max_racking", "5" },
+        { "loops", "5" },
+        { "passes", "3" },             // max_stack for flat_lace(_panel)
+        { "pattern_width", "5" },      // flat_lace_panel only
+        { "seed", "1" },
+        { "count", "100" },
+        { "state", "lm21" },           // lm21 or knitting
+        { "canonical", "1" },
+        { "prune", "1" },              // skip dominated transfer combinations (canonical only)
+        { "heuristic", "braid_prebuilt" },
+        { "algorithm", "a_star" },     // a_star, compressed_a_star, partial_expansion_a_star,
+                                       // ida_star, beam, external_a_star,
+                                       // breadth_first_heuristic_search or
+                                       // depth_first_branch_and_bound
+        { "beam_width", "100" },
+        { "keep_layers", "2" },        // breadth_first_heuristic_search only
+        { "expansion_threads", "0" },  // a_star only: threads expanding each state
+        { "parallel_transitions", "2000" }, // a_star only: transitions a state needs for that
+    };
+
+    Suite(const std::string& definition) {
+        std::istringstream in(definition);
+        std::string pair;
+        while (std::getline(in, pair, ',')) {
+            std::size_t eq = pair.find('=');
+            if (eq == std::string::npos) {
+                throw InvalidSuiteException();
+            }
+            std::string key = pair.substr(0, eq);
+            if (key == "name") {
+                name = pair.substr(eq + 1);
+            }
+            else if (values.count(key)) {
+                values[key] = pair.substr(eq + 1);
+            }
+            else {
+                throw InvalidSuiteException();
+            }
+        }
+        if (name.empty()) {
+            name = definition;
+            std::replace(name.begin(), name.end(), ',', ' ');
+        }
+    }
+
+    const std::string& operator[](const std::string& key) const {
+        return values.at(key);
+    }
+    int number(const std::string& key) const {
+        return std::stoi(values.at(key));
+    }
+
+    // whether the algorithm finds optimal plans, so that pruning must not
+    // change their lengths
+    bool optimal() const {
+        return values.at("algorithm") != "beam";
+    }
+
+    kn::KnittingMachine machine() const {
+        return kn::KnittingMachine(
+            (char)number("width"), (char)number("min_racking"), (char)number("max_racking")
+        );
+    }
+
+    std::vector<kn::TestCase> test_cases() const {
+        std::mt19937 rng((unsigned int)number("seed"));
+        std::vector<kn::TestCase> test_cases;
+        for (int i = 0; i < number("count"); i++) {
+            if (values.at("generator") == "flat_lace") {
+                test_cases.push_back(kn::flat_lace(machine(), number("loops"), number("passes"), rng));
+            }
+            else if (values.at("generator") == "simple_tube") {
+                test_cases.push_back(kn::simple_tube(machine(), number("loops"), number("passes"), rng));
+            }
+            else if (values.at("generator") == "flat_lace_panel") {
+                test_cases.push_back(kn::flat_lace_panel(
+                    machine(), number("pattern_width"), number("loops"), number("passes"), rng
+                ));
+            }
+            else {
+                throw InvalidSuiteException();
+            }
+        }
+        return test_cases;
+    }
+};
+
+class SuiteResult {
+public:
+    std::string name;
+    int count = 0;
+    int repetitions = 0;
+    long long path_length = 0;
+    // each test case's, from the last repetition; -1 where none was found
+    std::vector<int> path_lengths;
+    std::size_t search_tree_size = 0;
+    // median over repetitions
+    double seconds = 0;
+    // summed over the last repetition's searches (make PROFILE=1)
+    profile::Counters hardware;
+    // the largest of the last repetition's SearchStats::peak_bytes
+    // (make PROFILE=1), 0 if not counted
+    std::size_t peak_bytes = 0;
+
+    double problems_per_second() const {
+        return seconds > 0 ? count / seconds : 0;
+    }
+    double nodes_per_second() const {
+        return seconds > 0 ? (double)search_tree_size / seconds : 0;
+    }
+};
+
+// expansion_pool is null unless expansion_threads is set
+template <typename State, typename H>
+search::SearchResult<State> solve(
+    const Suite& suite, const kn::TestCase& test_case, H h, ThreadPool* expansion_pool
+) {
+    return test_case.solve<State>(suite.number("canonical"),
+        [&suite, &h, expansion_pool](const auto& sources, const auto& target, auto adj) {
+            const std::string& algorithm = suite["algorithm"];
+            if (algorithm == "a_star") {
+                search::SearchOptions options;
+                options.expansion_pool = expansion_pool;
+                options.parallel_transitions = (std::size_t)suite.number("parallel_transitions");
+                return search::a_star(sources, target, adj, h, options);
+            }
+            if (algorithm == "compressed_a_star") {
+                return search::compressed_a_star(sources, target, adj, h);
+            }
+            if (algorithm == "partial_expansion_a_star") {
+                return search::partial_expansion_a_star(sources, target, adj, h);
+            }
+            if (algorithm == "ida_star") {
+                return search::ida_star(sources, target, adj, h);
+            }
+            if (algorithm == "breadth_first_heuristic_search") {
+                return search::breadth_first_heuristic_search(
+                    sources, target, adj, h, (unsigned int)suite.number("keep_layers")
+                );
+            }
+            if (algorithm == "depth_first_branch_and_bound") {
+                return search::depth_first_branch_and_bound(sources, target, adj, h);
+            }
+            if (algorithm == "external_a_star") {
+                return external::a_star(sources, target, adj, h);
+            }
+            if (algorithm == "beam") {
+                return search::beam_search(
+                    sources, target, adj, h, (std::size_t)suite.number("beam_width"),
+                    [](const auto&) { }
+                );
+            }
+            throw InvalidSuiteException();
+        },
+        suite.number("prune")
+    );
+}
+
+template <typename State, typename H>
+void run_once(
+    const Suite& suite, const std::vector<kn::TestCase>& test_cases, H h,
+    ThreadPool* expansion_pool, SuiteResult& result
+) {
+    result.path_length = 0;
+    result.path_lengths.clear();
+    result.search_tree_size = 0;
+    result.hardware = profile::Counters();
+    result.hardware.available = true;
+    result.peak_bytes = 0;
+    for (const kn::TestCase& test_case : test_cases) {
+        auto search_result = solve<State>(suite, test_case, h, expansion_pool);
+        result.path_length += search_result.path_length;
+        result.path_lengths.push_back(search_result.path_length);
+        result.search_tree_size += search_result.search_tree_size;
+        result.hardware += search_result.stats.hardware;
+        result.peak_bytes = std::max(result.peak_bytes, search_result.stats.peak_bytes);
+    }
+}
+
+template <typename State>
+void run_once(
+    const Suite& suite, const std::vector<kn::TestCase>& test_cases,
+    ThreadPool* expansion_pool, SuiteResult& result
+) {
+    const std::string& heuristic = suite["heuristic"];
+    if (heuristic == "none") run_once<State>(suite, test_cases, heuristics::None(), expansion_pool, result);
+    else if (heuristic == "target") run_once<State>(suite, test_cases, heuristics::Target(), expansion_pool, result);
+    else if (heuristic == "braid") run_once<State>(suite, test_cases, heuristics::Braid(), expansion_pool, result);
+    else if (heuristic == "log") run_once<State>(suite, test_cases, heuristics::Log(), expansion_pool, result);
+    else if (heuristic == "prebuilt") run_once<State>(suite, test_cases, heuristics::Prebuilt(), expansion_pool, result);
+    else if (heuristic == "braid_log") run_once<State>(suite, test_cases, heuristics::BraidLog(), expansion_pool, result);
+    else if (heuristic == "braid_prebuilt") run_once<State>(suite, test_cases, heuristics::BraidPrebuilt(), expansion_pool, result);
+    else throw InvalidSuiteException();
+}
+
+SuiteResult run(const Suite& suite, int repetitions) {
+    std::vector<kn::TestCase> test_cases = suite.test_cases();
+    SuiteResult result;
+    result.name = suite.name;
+    result.count = (int)test_cases.size();
+    result.repetitions = repetitions;
+
+    std::unique_ptr<ThreadPool> expansion_pool;
+    if (suite.number("expansion_threads") > 0) {
+        expansion_pool = std::make_unique<ThreadPool>((unsigned int)suite.number("expansion_threads"));
+    }
+
+    std::vector<double> seconds;
+    for (int r = 0; r < repetitions; r++) {
+        StopWatch stop_watch;
+        if (suite["state"] == "lm21") {
+            run_once<kn::KnittingStateLM21>(suite, test_cases, expansion_pool.get(), result);
+        }
+        else if (suite["state"] == "knitting") {
+            run_once<kn::KnittingState>(suite, test_cases, expansion_pool.get(), result);
+        }
+        else {
+            throw InvalidSuiteException();
+        }
+        seconds.push_back(stop_watch.stop());
+    }
+
+    std::sort(seconds.begin(), seconds.end());
+    result.seconds = seconds[seconds.size() / 2];
+    return result;
+}
+
+// s as a JSON string, quoted and escaped
+std::string json_string(const std::string& s) {
+    std::ostringstream o;
+    o << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            o << '\\' << c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            o << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+        }
+        else {
+            o << c;
+        }
+    }
+    o << '"';
+    return o.str();
+}
+
+// s as a quoted CSV field, with its quotes doubled
+std::string csv_field(const std::string& s) {
+    std::string field = "\"";
+    for (char c : s) {
+        field += c;
+        if (c == '"') {
+            field += '"';
+        }
+    }
+    return field + "\"";
+}
+
+// Baseline rows by suite name, read from the CSV this program writes.
+std::map<std::string, SuiteResult> read_baseline(const std::string& path) {
+    std::map<std::string, SuiteResult> baseline;
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+
+    while (std::getline(in, line)) {
+        // the name is quoted (see csv_field), the other fields are numbers
+        if (line.empty() || line[0] != '"') {
+            continue;
+        }
+        SuiteResult result;
+        std::size_t end = 1;
+        for (; end < line.size(); end++) {
+            if (line[end] == '"') {
+                if (end + 1 < line.size() && line[end + 1] == '"') {
+                    end++;
+                }
+                else {
+                    break;
+                }
+            }
+            result.name += line[end];
+        }
+        if (end + 2 > line.size()) {
+            continue;
+        }
+        std::string fields = line.substr(end + 2);
+        std::replace(fields.begin(), fields.end(), ',', ' ');
+        std::istringstream row(fields);
+        row >> result.count >> result.repetitions >> result.path_length
+            >> result.search_tree_size >> result.seconds;
+        baseline[result.name] = result;
+    }
+    return baseline;
+}
+
+// bin/bench [--config FILE] [--repetitions N] [--format csv|json]
+//           [--baseline FILE] [--tolerance X] [--no-pruning]
+//           [--verify-pruning] [SUITE...]
+//
+// Runs every suite (see Suite) `repetitions` times and reports the median
+// time. With a baseline written by an earlier CSV run, suites whose
+// problems/second dropped by more than the tolerance (default 0.1), or
+// whose total path length changed, are reported on stderr, and the exit
+// status is 1. --no-pruning sets prune=0 on every suite; --verify-pruning
+// runs each suite of an optimal algorithm once more with prune=0 and does
+// the same for every test case whose path length differs, or that either
+// run found no plan for.
+int main(int argc, char** argv) {
+    std::vector<Suite> suites;
+    int repetitions = 3;
+    std::string format = "csv";
+    std::string baseline_path;
+    double tolerance = 0.1;
+    bool pruning = true;
+    bool verify_pruning = false;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--config" && i + 1 < argc) {
+                std::ifstream config(argv[++i]);
+                std::string line;
+                while (std::getline(config, line)) {
+                    if (!line.empty() && line[0] != '#') {
+                        suites.emplace_back(line);
+                    }
+                }
+            }
+            else if (arg == "--repetitions" && i + 1 < argc) {
+                repetitions = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--format" && i + 1 < argc) {
+                format = argv[++i];
+            }
+            else if (arg == "--baseline" && i + 1 < argc) {
+                baseline_path = argv[++i];
+            }
+            else if (arg == "--tolerance" && i + 1 < argc) {
+                tolerance = std::stod(argv[++i]);
+            }
+            else if (arg == "--no-pruning") {
+                pruning = false;
+            }
+            else if (arg == "--verify-pruning") {
+                verify_pruning = true;
+            }
+            else {
+                suites.emplace_back(arg);
+            }
+        }
+    }
+    catch (const InvalidSuiteException&) {
+        std::cerr << "invalid suite\n";
+        return 2;
+    }
+    if (suites.empty()) {
+        suites.emplace_back("generator=flat_lace,width=7,loops=5,passes=3,seed=1");
+        suites.emplace_back("generator=simple_tube,width=10,loops=8,passes=3,seed=1");
+    }
+    if (!pruning) {
+        for (Suite& suite : suites) {
+            suite.values["prune"] = "0";
+        }
+    }
+
+    int min_racking = 0;
+    int max_racking = 0;
+    for (const Suite& suite : suites) {
+        min_racking = std::min(min_racking, suite.number("min_racking"));
+        max_racking = std::max(max_racking, suite.number("max_racking"));
+    }
+    prebuilt::construct_table(8, min_racking, max_racking);
+
+    std::vector<SuiteResult> results;
+    for (const Suite& suite : suites) {
+        try {
+            results.push_back(run(suite, repetitions));
+        }
+        catch (const InvalidSuiteException&) {
+            std::cerr << "invalid suite: " << suite.name << "\n";
+            return 2;
+        }
+    }
+
+    if (format == "json") {
+        std::cout << "[\n";
+        for (std::size_t i = 0; i < results.size(); i++) {
+            const SuiteResult& r = results[i];
+            std::cout << "  {\"suite\": " << json_string(r.name) << ", \"count\": " << r.count
+                      << ", \"repetitions\": " << r.repetitions
+                      << ", \"path_length\": " << r.path_length
+                      << ", \"search_tree_size\": " << r.search_tree_size
+                      << ", \"seconds\": " << r.seconds
+                      << ", \"problems_per_second\": " << r.problems_per_second()
+                      << ", \"nodes_per_second\": " << r.nodes_per_second();
+            if (r.hardware.available) {
+                std::cout << ", \"cycles\": " << r.hardware.cycles
+                          << ", \"instructions\": " << r.hardware.instructions
+                          << ", \"cache_misses\": " << r.hardware.cache_misses
+                          << ", \"branch_misses\": " << r.hardware.branch_misses;
+            }
+            if (r.peak_bytes > 0) {
+                std::cout << ", \"peak_bytes\": " << r.peak_bytes;
+            }
+            std::cout << "}"
+                      << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        std::cout << "]\n";
+    }
+    else {
+        std::cout << "suite,count,repetitions,path_length,search_tree_size,seconds,"
+                     "problems_per_second,nodes_per_second,"
+                     "cycles,instructions,cache_misses,branch_misses,peak_bytes\n";
+        for (const SuiteResult& r : results) {
+            std::cout << csv_field(r.name) << "," << r.count << "," << r.repetitions << ","
+                      << r.path_length << "," << r.search_tree_size << "," << r.seconds << ","
+                      << r.problems_per_second() << "," << r.nodes_per_second() << ",";
+            // empty when the counters are unavailable
+            if (r.hardware.available) {
+                std::cout << r.hardware.cycles << "," << r.hardware.instructions << ","
+                          << r.hardware.cache_misses << "," << r.hardware.branch_misses;
+            }
+            else {
+                std::cout << ",,,";
+            }
+            std::cout << ",";
+            if (r.peak_bytes > 0) {
+                std::cout << r.peak_bytes;
+            }
+            std::cout << "\n";
+        }
+    }
+
+    int regressions = 0;
+    if (verify_pruning) {
+        for (std::size_t i = 0; i < suites.size(); i++) {
+            if (!suites[i].optimal()) {
+                continue;
+            }
+            Suite unpruned_suite = suites[i];
+            unpruned_suite.values["prune"] = "0";
+            SuiteResult unpruned = run(unpruned_suite, 1);
+            const std::vector<int>& pruned = results[i].path_lengths;
+            for (std::size_t j = 0; j < pruned.size(); j++) {
+                if (pruned[j] != unpruned.path_lengths[j] || pruned[j] < 0) {
+                    std::cerr << "pruning changed path length: " << results[i].name
+                              << " #" << j << ": " << unpruned.path_lengths[j] << " -> "
+                              << pruned[j] << "\n";
+                    regressions++;
+                }
+            }
+        }
+    }
+
+    if (baseline_path.empty()) {
+        return regressions == 0 ? 0 : 1;
+    }
+
+    auto baseline = read_baseline(baseline_path);
+    for (const SuiteResult& r : results) {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end()) {
+            continue;
+        }
+        const SuiteResult& b = it->second;
+        if (r.path_length != b.path_length) {
+            std::cerr << "path length changed: " << r.name << ": "
+                      << b.path_length << " -> " << r.path_length << "\n";
+            regressions++;
+        }
+        if (r.problems_per_second() < (1 - tolerance) * b.problems_per_second()) {
+            std::cerr << "throughput regression: " << r.name << ": "
+                      << b.problems_per_second() << " -> " << r.problems_per_second()
+                      << " problems/s\n";
+            regressions++;
+        }
+    }
+    return regressions == 0 ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include "knitting.h"
+#include "plan.h"
+#include "service.h"
+#include "testgen.h"
+#include "util.h"
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+namespace kn = knitting;
+
+// Sends every line of stdin, a TestCase key, as a request and prints the
+// plans in the order they arrive.
+int interactive(const std::string& socket_path) {
+    int fd = service::connect(socket_path);
+    std::vector<std::string> keys;
+    std::string key;
+    while (std::getline(std::cin, key)) {
+        service::write_all(fd, std::to_string(keys.size()) + " " + key + "\n");
+        keys.push_back(key);
+    }
+
+    service::LineReader in(fd);
+    std::string id;
+    std::optional<kn::Plan> plan;
+    for (std::size_t i = 0; i < keys.size() && service::read_response(in, id, plan); i++) {
+        std::cout << "# " << id << "\n" << (plan ? plan->serialize() : "error\n");
+    }
+    close(fd);
+    return 0;
+}
+
+// Sends count requests, cycling through `distinct` generated problems, over
+// the given number of connections, each with all of its requests in
+// flight at once. Reports throughput, latency and invalid plans.
+int load(
+    const std::string& socket_path, const std::string& generator,
+    int count, int connections, int distinct
+) {
+    std::mt19937 rng(1);
+    std::vector<kn::TestCase> problems;
+    for (int i = 0; i < distinct; i++) {
+        if (generator == "flat_lace") {
+            problems.push_back(kn::flat_lace(kn::KnittingMachine(7, -5, 5), 5, 3, rng));
+        }
+        else if (generator == "simple_tube") {
+            problems.push_back(kn::simple_tube(kn::KnittingMachine(10, -5, 5), 8, 3, rng));
+        }
+        else {
+            std::cerr << "unknown generator " << generator << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<double> latencies(count);
+    std::vector<int> invalid(connections, 0);
+    std::vector<std::thread> threads;
+    StopWatch stop_watch;
+
+    for (int c = 0; c < connections; c++) {
+        threads.emplace_back([&, c]() {
+            int fd = service::connect(socket_path);
+            std::unordered_map<int, StopWatch> sent;
+            for (int i = c; i < count; i += connections) {
+                sent[i].start();
+                service::write_all(fd, service::request(std::to_string(i), problems[i % distinct]));
+            }
+
+            service::LineReader in(fd);
+            std::string id;
+            std::optional<kn::Plan> plan;
+            for (std::size_t received = 0; received < sent.size(); received++) {
+                if (!service::read_response(in, id, plan)) {
+                    invalid[c] += (int)(sent.size() - received);
+                    break;
+                }
+                int i = std::stoi(id);
+                latencies[i] = sent[i].stop();
+
+                const kn::TestCase& test_case = problems[i % distinct];
+                kn::KnittingStateLM21 target = test_case.target_state<kn::KnittingStateLM21>();
+                kn::KnittingStateLM21 state = test_case.source_state<kn::KnittingStateLM21>(&target);
+                // a source that only needs racking has an empty plan
+                if (!(
+                    plan &&
+                    state.rack(plan->commands.empty() ? target.racking() : plan->start_racking) &&
+                    plan->apply(state, true) && state == target
+                )) {
+                    invalid[c]++;
+                }
+            }
+            close(fd);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds_taken = stop_watch.stop();
+
+    int fd = service::connect(socket_path);
+    service::write_all(fd, "stats\n");
+    service::LineReader in(fd);
+    std::string stats;
+    in.read_line(stats);
+    close(fd);
+
+    std::sort(latencies.begin(), latencies.end());
+    int invalid_count = 0;
+    for (int x : invalid) {
+        invalid_count += x;
+    }
+
+    // requests/second, median and p99 latency, invalid plans, daemon cache stats
+    std::cout << count / seconds_taken << " "
+              << latencies[latencies.size() / 2] << " "
+              << latencies[(std::size_t)(0.99 * (double)(latencies.size() - 1))] << " "
+              << invalid_count << " " << stats << std::endl;
+    return invalid_count == 0 ? 0 : 1;
+}
+
+// bin/client SOCKET
+// bin/client SOCKET flat_lace|simple_tube COUNT [CONNECTIONS] [DISTINCT]
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " SOCKET [flat_lace|simple_tube COUNT [CONNECTIONS] [DISTINCT]]\n";
+        return 1;
+    }
+    if (argc < 4) {
+        return interactive(argv[1]);
+    }
+
+    int count = std::stoi(argv[3]);
+    int connections = argc > 4 ? std::stoi(argv[4]) : 1;
+    int distinct = argc > 5 ? std::stoi(argv[5]) : count;
+    return load(argv[1], argv[2], count, connections, distinct);
+}
@@ -0,0 +1,140 @@
+#include "knitting.h"
+#include "heuristics.h"
+#include "plan_cache.h"
+#include "prebuilt.h"
+#include "search.h"
+#include "service.h"
+#include "testgen.h"
+#include "util.h"
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace kn = knitting;
+
+// the racking range of the prebuilt table
+const int table_min_racking = -5;
+const int table_max_racking = 5;
+
+// A client connection, closed once the reader and every job answering one
+// of its requests are done with it.
+class Connection {
+public:
+    int fd;
+    std::mutex write_mutex;
+
+    Connection(int fd) : fd(fd) { }
+    ~Connection() { close(fd); }
+
+    void send(const std::string& s) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        try {
+            service::write_all(fd, s);
+        }
+        catch (const service::SocketException&) {
+            // the client went away; its remaining answers are dropped
+        }
+    }
+};
+
+class SearchAbortedException { };
+
+kn::Plan solve(
+    cache::PlanCache& plan_cache, const kn::TestCase& test_case, const search::SearchOptions& options
+) {
+    const kn::KnittingMachine& machine = test_case.knitting_machine();
+    bool in_table =
+        machine.min_racking >= table_min_racking && machine.max_racking <= table_max_racking;
+
+    return plan_cache.plan(test_case, [in_table, &options](const kn::TestCase& normalized) {
+        auto result = normalized.solve<kn::KnittingStateLM21>(true,
+            [in_table, &options](const auto& sources, const auto& target, auto adj) {
+                if (in_table) {
+                    return search::a_star(sources, target, adj, heuristics::BraidPrebuilt(), options);
+                }
+                return search::a_star(sources, target, adj, heuristics::BraidLog(), options);
+            }
+        );
+        if (!result.found()) {
+            // not cached, so a later request can try again
+            throw SearchAbortedException();
+        }
+        return result;
+    });
+}
+
+void serve(
+    int fd, ThreadPool& pool, cache::PlanCache& plan_cache, const search::SearchOptions& options
+) {
+    auto connection = std::make_shared<Connection>(fd);
+    service::LineReader in(fd);
+    std::string line;
+
+    while (in.read_line(line)) {
+        if (line == "stats") {
+            connection->send(
+                "stats " + std::to_string(plan_cache.hits()) + " " +
+                std::to_string(plan_cache.misses()) + " " +
+                std::to_string(plan_cache.coalesced()) + "\n"
+            );
+            continue;
+        }
+
+        std::size_t space = line.find(' ');
+        std::string id = line.substr(0, space);
+        std::string key = space == std::string::npos ? "" : line.substr(space + 1);
+
+        pool.submit([connection, id, key, &plan_cache, &options]() {
+            try {
+                kn::Plan plan = solve(plan_cache, kn::TestCase::parse(key), options);
+                connection->send(service::response(id, plan));
+            }
+            catch (...) {
+                connection->send(service::error_response(id));
+            }
+        });
+    }
+}
+
+// bin/daemon SOCKET [CACHE_FILE] [THREADS] [DEADLINE_SECONDS]
+//
+// Answers planning requests (see service.h) until killed. The prebuilt
+// table and the plan cache are shared by all requests, and identical
+// requests being solved at the same time are solved once. A search that
+// runs past the deadline (60 seconds by default) is answered with an error.
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " SOCKET [CACHE_FILE] [THREADS] [DEADLINE_SECONDS]\n";
+        return 1;
+    }
+    std::string socket_path = argv[1];
+    std::string cache_path = argc > 2 ? argv[2] : "bin/daemon.cache";
+    unsigned int threads = argc > 3 ? (unsigned int)std::stoul(argv[3]) : std::thread::hardware_concurrency();
+    search::SearchOptions options;
+    options.deadline_seconds = argc > 4 ? std::stod(argv[4]) : 60;
+
+    // answers to clients that hung up are dropped, not fatal
+    std::signal(SIGPIPE, SIG_IGN);
+
+    prebuilt::construct_table(8, table_min_racking, table_max_racking);
+    cache::PlanCache plan_cache(cache_path);
+    ThreadPool pool(threads);
+    int listener = service::listen(socket_path);
+
+    std::cerr << "listening on " << socket_path << "\n";
+
+    while (true) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        std::thread([fd, &pool, &plan_cache, &options]() {
+            serve(fd, pool, plan_cache, options);
+        }).detach();
+    }
+}
@@ -0,0 +1,221 @@
+#include "external.h"
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <unistd.h>
+
+namespace external {
+
+// each field as a 4-byte little-endian length followed by its bytes
+RecordWriter::RecordWriter(const fs::path& path) :
+    out(path, std::ios::binary | std::ios::app)
+{
+    if (!out) {
+        throw ScratchIOException();
+    }
+}
+
+void RecordWriter::write(const Record& record) {
+    for (const std::string* field : { &record.state, &record.parent, &record.action }) {
+        char length[4];
+        for (int k = 0; k < 4; k++) {
+            length[k] = (char)((field->size() >> (8*k)) & 0xff);
+        }
+        out.write(length, 4);
+        out.write(field->data(), (std::streamsize)field->size());
+    }
+    if (!out) {
+        throw ScratchIOException();
+    }
+}
+
+void RecordWriter::close() {
+    out.close();
+    if (!out) {
+        throw ScratchIOException();
+    }
+}
+
+RecordReader::RecordReader(const fs::path& path) :
+    in(path, std::ios::binary)
+{
+    if (!in) {
+        throw ScratchIOException();
+    }
+}
+
+bool RecordReader::read(Record& record) {
+    for (std::string* field : { &record.state, &record.parent, &record.action }) {
+        unsigned char length[4];
+        if (!in.read((char*)length, 4)) {
+            if (field == &record.state && in.gcount() == 0) {
+                return false;
+            }
+            throw ScratchIOException();
+        }
+        std::size_t size = 0;
+        for (int k = 0; k < 4; k++) {
+            size |= (std::size_t)length[k] << (8*k);
+        }
+        field->resize(size);
+        if (!in.read(field->data(), (std::streamsize)size)) {
+            throw ScratchIOException();
+        }
+    }
+    return true;
+}
+
+// Merges sorted files, writing one record per state to out. Each file has
+// at most one record per state.
+static std::size_t merge_unique(const std::vector<fs::path>& paths, const fs::path& to) {
+    std::vector<std::unique_ptr<RecordReader>> readers;
+    std::vector<Record> heads(paths.size());
+    auto later = [&heads](std::size_t a, std::size_t b) {
+        return heads[a].state > heads[b].state;
+    };
+    std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(later)> q(later);
+
+    for (std::size_t i = 0; i < paths.size(); i++) {
+        readers.push_back(std::make_unique<RecordReader>(paths[i]));
+        if (readers[i]->read(heads[i])) {
+            q.push(i);
+        }
+    }
+
+    RecordWriter writer(to);
+    std::size_t written = 0;
+    std::string last;
+    while (!q.empty()) {
+        std::size_t i = q.top();
+        q.pop();
+        if (written == 0 || heads[i].state != last) {
+            writer.write(heads[i]);
+            last = heads[i].state;
+            written++;
+        }
+        if (readers[i]->read(heads[i])) {
+            q.push(i);
+        }
+    }
+    writer.close();
+    return written;
+}
+
+std::size_t sort_unique(const fs::path& from, const fs::path& to, std::size_t run_records) {
+    RecordReader reader(from);
+    std::vector<fs::path> runs;
+    std::vector<Record> run;
+    std::size_t written = 0;
+
+    auto write_run = [&](const fs::path& path) {
+        std::sort(run.begin(), run.end(), [](const Record& a, const Record& b) {
+            return a.state < b.state;
+        });
+        RecordWriter writer(path);
+        written = 0;
+        for (std::size_t i = 0; i < run.size(); i++) {
+            if (i == 0 || run[i].state != run[i - 1].state) {
+                writer.write(run[i]);
+                written++;
+            }
+        }
+        writer.close();
+        run.clear();
+    };
+
+    for (Record record; reader.read(record); ) {
+        run.push_back(std::move(record));
+        if (run.size() >= std::max<std::size_t>(run_records, 1)) {
+            runs.push_back(to.string() + ".run-" + std::to_string(runs.size()));
+            write_run(runs.back());
+        }
+    }
+    if (runs.empty()) {
+        write_run(to);
+        return written;
+    }
+    if (!run.empty()) {
+        runs.push_back(to.string() + ".run-" + std::to_string(runs.size()));
+        write_run(runs.back());
+    }
+
+    written = merge_unique(runs, to);
+    for (const auto& path : runs) {
+        fs::remove(path);
+    }
+    return written;
+}
+
+std::size_t subtract(
+    const fs::path& candidates, const std::vector<fs::path>& closed, const fs::path& to
+) {
+    RecordReader reader(candidates);
+    std::vector<std::unique_ptr<RecordReader>> closed_readers;
+    std::vector<std::optional<Record>> heads(closed.size());
+    for (std::size_t i = 0; i < closed.size(); i++) {
+        closed_readers.push_back(std::make_unique<RecordReader>(closed[i]));
+        heads[i].emplace();
+        if (!closed_readers[i]->read(*heads[i])) {
+            heads[i].reset();
+        }
+    }
+
+    RecordWriter writer(to);
+    std::size_t written = 0;
+    for (Record record; reader.read(record); ) {
+        bool seen = false;
+        for (std::size_t i = 0; i < closed.size(); i++) {
+            while (heads[i] && heads[i]->state < record.state) {
+                if (!closed_readers[i]->read(*heads[i])) {
+                    heads[i].reset();
+                }
+            }
+            seen = seen || (heads[i] && heads[i]->state == record.state);
+        }
+        if (!seen) {
+            writer.write(record);
+            written++;
+        }
+    }
+    writer.close();
+    return written;
+}
+
+void merge(const fs::path& a, const fs::path& b, const fs::path& to) {
+    merge_unique({ a, b }, to);
+}
+
+std::optional<Record> find(const fs::path& sorted, const std::string& state) {
+    RecordReader reader(sorted);
+    for (Record record; reader.read(record); ) {
+        if (record.state == state) {
+            return record;
+        }
+        if (record.state > state) {
+            break;
+        }
+    }
+    return std::nullopt;
+}
+
+ScratchDirectory::ScratchDirectory(const fs::path& parent) {
+    static std::atomic<unsigned int> count = 0;
+    directory = parent / (
+        "external-a-star-" + std::to_string(getpid()) + "-" + std::to_string(count++)
+    );
+    std::error_code error;
+    if (!fs::create_directories(directory, error)) {
+        throw ScratchIOException();
+    }
+}
+
+ScratchDirectory::~ScratchDirectory() {
+    std::error_code error;
+    fs::remove_all(directory, error);
+}
+
+const fs::path& ScratchDirectory::path() const {
+    return directory;
+}
+
+}
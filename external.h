@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "search.h"
+#include "util.h"
+
+#ifndef EXTERNAL_H
+#define EXTERNAL_H
+
+// A* for searches whose stored states exceed memory, keeping open and
+// closed states in files on disk (see a_star below). States must provide
+// encode() and decode() (see KnittingState::encode).
+namespace external {
+
+namespace fs = std::filesystem;
+
+class ScratchIOException { };
+
+// One stored state: its encoding, its parent's encoding (empty for a
+// source) and the bytes of the action from the parent.
+class Record {
+public:
+    std::string state;
+    std::string parent;
+    std::string action;
+};
+
+// Records appended to a file, written and read back sequentially.
+class RecordWriter {
+private:
+    std::ofstream out;
+
+public:
+    RecordWriter(const fs::path&);
+    void write(const Record&);
+    void close();
+};
+
+class RecordReader {
+private:
+    std::ifstream in;
+
+public:
+    RecordReader(const fs::path&);
+    // false at the end of the file
+    bool read(Record&);
+};
+
+// Sorts the records of from by state into to, keeping one record per
+// state. At most run_records are held in memory; longer files are sorted
+// in runs, written to the directory of `to` and merged. Returns the number
+// of records written.
+std::size_t sort_unique(const fs::path& from, const fs::path& to, std::size_t run_records);
+
+// Writes the records of the sorted file candidates whose states are in
+// none of the sorted files closed to `to`, returning how many there were.
+std::size_t subtract(
+    const fs::path& candidates, const std::vector<fs::path>& closed, const fs::path& to
+);
+
+// Merges two sorted files with no state in common into to.
+void merge(const fs::path& a, const fs::path& b, const fs::path& to);
+
+// The record for state in the sorted file, read up to where it would be.
+std::optional<Record> find(const fs::path& sorted, const std::string& state);
+
+// A new, uniquely named directory under parent, deleted with its contents
+// on destruction.
+class ScratchDirectory {
+private:
+    fs::path directory;
+
+public:
+    ScratchDirectory(const fs::path& parent);
+    ScratchDirectory(const ScratchDirectory&) = delete;
+    ~ScratchDirectory();
+
+    const fs::path& path() const;
+};
+
+class Options {
+public:
+    fs::path scratch_directory = fs::temp_directory_path();
+    // records sorted in memory at once
+    std::size_t run_records = 1 << 20;
+    unsigned int limit = 1e9;
+};
+
+// A* with delayed duplicate detection. Open states are appended, unsorted,
+// to one file per (f, g) bucket. Buckets are expanded in order of f, then
+// g: each is sorted and deduplicated, states already expanded with a g no
+// larger are removed by merging against the sorted closed files, and the
+// rest are expanded and merged into the closed file for their g. Only
+// sequential file access is used, and memory is bounded by run_records
+// plus one write buffer per open bucket. f-values are kept monotone along
+// paths (pathmax), so the first target expanded is optimal for any
+// admissible heuristic. The plan is rebuilt from the parent encodings in
+// the closed files. search_tree_size counts expansions.
+template <typename State, typename Adj, typename H>
+search::SearchResult<State> a_star(
+    const std::vector<State>& sources, const State& target,
+    Adj adj, H h,
+    const Options& options = Options()
+) {
+    using Backpointer = typename State::Backpointer;
+    using Action = std::remove_cvref_t<decltype(std::declval<Backpointer>().action)>;
+    static_assert(std::is_trivially_copyable_v<Action>);
+
+    StopWatch stop_watch;
+    std::size_t expanded = 0;
+    auto not_found = [&]() {
+        return search::SearchResult<State>(
+            std::vector<Backpointer>(), -1, expanded, stop_watch.stop()
+        );
+    };
+    if (sources.empty()) {
+        return not_found();
+    }
+
+    ScratchDirectory scratch(options.scratch_directory);
+    const State& prototype = sources.front();
+    auto decode = [&prototype](const std::string& bytes) {
+        State state = prototype;
+        state.decode(bytes);
+        return state;
+    };
+
+    auto bucket_path = [&scratch](unsigned int f, unsigned int g) {
+        return scratch.path() / ("open-" + std::to_string(f) + "-" + std::to_string(g));
+    };
+    auto closed_path = [&scratch](unsigned int g) {
+        return scratch.path() / ("closed-" + std::to_string(g));
+    };
+
+    std::map<std::pair<unsigned int, unsigned int>, RecordWriter> open;
+    auto push = [&](unsigned int f, unsigned int g, const Record& record) {
+        auto it = open.find({ f, g });
+        if (it == open.end()) {
+            it = open.try_emplace({ f, g }, bucket_path(f, g)).first;
+        }
+        it->second.write(record);
+    };
+    std::map<unsigned int, fs::path> closed;
+
+    for (const State& source : sources) {
+        push(std::invoke(h, source), 0, Record { source.encode(), "", "" });
+    }
+
+    while (!open.empty()) {
+        auto [f, g] = open.begin()->first;
+        if (f > options.limit) {
+            return not_found();
+        }
+        open.begin()->second.close();
+        open.erase(open.begin());
+
+        fs::path bucket = bucket_path(f, g);
+        fs::path sorted = bucket.string() + ".sorted";
+        fs::path fresh = bucket.string() + ".fresh";
+        sort_unique(bucket, sorted, options.run_records);
+        fs::remove(bucket);
+
+        std::vector<fs::path> no_worse;
+        for (const auto& [closed_g, path] : closed) {
+            if (closed_g <= g) {
+                no_worse.push_back(path);
+            }
+        }
+        subtract(sorted, no_worse, fresh);
+        fs::remove(sorted);
+
+        RecordReader reader(fresh);
+        for (Record record; reader.read(record); ) {
+            State state = decode(record.state);
+            expanded++;
+
+            if (state == target) {
+                // follow the parents back through the closed files
+                std::vector<Backpointer> path;
+                while (!record.parent.empty()) {
+                    Action action;
+                    std::memcpy(&action, record.action.data(), sizeof(Action));
+                    path.emplace_back(decode(record.parent), action);
+
+                    std::optional<Record> parent;
+                    for (auto it = closed.begin(); !parent && it != closed.end(); it++) {
+                        parent = find(it->second, record.parent);
+                    }
+                    if (!parent) {
+                        throw ScratchIOException();
+                    }
+                    record = *parent;
+                }
+                std::reverse(path.begin(), path.end());
+                return search::SearchResult<State>(path, (int)g, expanded, stop_watch.stop());
+            }
+
+            auto it = std::invoke(adj, state);
+            while (it.has_next()) {
+                unsigned int next_g = g + it.weight;
+                unsigned int next_f = std::max(f, next_g + std::invoke(h, it.next));
+                std::string action(sizeof(Action), '\0');
+                std::memcpy(action.data(), &it.action, sizeof(Action));
+                push(next_f, next_g, Record { it.next.encode(), record.state, action });
+            }
+        }
+
+        auto old = closed.find(g);
+        if (old == closed.end()) {
+            fs::rename(fresh, closed_path(g));
+            closed.emplace(g, closed_path(g));
+        }
+        else {
+            fs::path merged = closed_path(g).string() + ".merged";
+            merge(old->second, fresh, merged);
+            fs::remove(fresh);
+            fs::rename(merged, old->second);
+        }
+    }
+
+    return not_found();
+}
+
+}
+
+#endif
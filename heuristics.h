@@ -0,0 +1,93 @@
+#include <algorithm>
+
+#ifndef HEURISTICS_H
+#define HEURISTICS_H
+
+// Function objects for the search templates in search.h. Unlike member
+// function pointers, these are resolved at compile time, so the heuristic
+// and expansion calls in the search loops are direct calls. They work with
+// both KnittingState and KnittingStateLM21.
+namespace heuristics {
+
+struct Adjacent {
+    template <typename State>
+    auto operator()(const State& state) const {
+        return state.adjacent();
+    }
+};
+
+// With prune false, dominated transfer combinations are enumerated too
+// (see KnittingState::TransitionIterator).
+struct CanonicalAdjacent {
+    bool prune = true;
+
+    template <typename State>
+    auto operator()(const State& state) const {
+        return typename State::TransitionIterator(state, true, prune);
+    }
+};
+
+// Wraps any heuristic member function, e.g. Member<&State::log_heuristic>.
+template <auto h>
+struct Member {
+    template <typename State>
+    unsigned int operator()(const State& state) const {
+        return (state.*h)();
+    }
+};
+
+struct None {
+    template <typename State>
+    unsigned int operator()(const State& state) const {
+        return state.no_heuristic();
+    }
+};
+
+struct Target {
+    template <typename State>
+    unsigned int operator()(const State& state) const {
+        return state.target_heuristic();
+    }
+};
+
+struct Braid {
+    template <typename State>
+    unsigned int operator()(const State& state) const {
+        return state.braid_heuristic();
+    }
+};
+
+struct Log {
+    template <typename State>
+    unsigned int operator()(const State& state) const {
+        return state.log_heuristic();
+    }
+};
+
+struct Prebuilt {
+    template <typename State>
+    unsigned int operator()(const State& state) const {
+        return state.prebuilt_heuristic();
+    }
+};
+
+// The maximum of admissible heuristics is admissible.
+template <typename... Hs>
+struct Max {
+    template <typename State>
+    unsigned int operator()(const State& state) const {
+        unsigned int x = 0;
+        ((x = std::max(x, Hs()(state))), ...);
+        return x;
+    }
+};
+
+// Fused equivalents of braid_log_heuristic and braid_prebuilt_heuristic.
+// Braid falls back to target_heuristic for a trivial braid, so these are
+// never weaker than the member function versions.
+using BraidLog = Max<Braid, Log>;
+using BraidPrebuilt = Max<Braid, Prebuilt>;
+
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include "knitting.h"
+#include <bit>
 #include "cbraid.h"
 #include "prebuilt.h"
+#include "profile.h"
 #include "util.h"
 
 namespace knitting {
@@ -73,28 +75,28 @@ KnittingMachine::KnittingMachine(const KnittingMachine& other) :
     racking(other.racking)
 { }
 
-NeedleLabel KnittingMachine::operator[](char i) const {
+NeedleLabel KnittingMachine::operator[](int i) const {
     if (i < abs(racking)) {
-        return NeedleLabel(racking > 0, i);
+        return NeedleLabel(racking > 0, (char)i);
     }
     if (i >= 2*width - abs(racking)) {
-        return NeedleLabel(racking < 0, i - width);
+        return NeedleLabel(racking < 0, (char)(i - width));
     }
-    i -= (char)abs(racking);
+    i -= abs(racking);
     if (i % 2 == 0) {
         if (racking > 0) {
-            return NeedleLabel(false, i/2);
+            return NeedleLabel(false, (char)(i/2));
         }
         else {
-            return NeedleLabel(false, i/2 - racking);
+            return NeedleLabel(false, (char)(i/2 - racking));
         }
     }
     else {
         if (racking > 0) {
-            return NeedleLabel(true, i/2 + racking);
+            return NeedleLabel(true, (char)(i/2 + racking));
         }
         else {
-            return NeedleLabel(true, i/2);
+            return NeedleLabel(true, (char)(i/2));
         }
     }
 }
@@ -123,8 +125,68 @@ void SlackConstraint::replace(NeedleLabel from, NeedleLabel to) {
     }
 }
 
+Action::Action(unsigned long long to_front, unsigned long long to_back, char racking) :
+    to_front(to_front),
+    to_back(to_back),
+    racking(racking)
+{ }
+
+std::string Action::command() const {
+    std::string command = "xfer";
+    unsigned long long xfers = to_front | to_back;
+    if (xfers == 0) {
+        command += " none";
+    }
+    for (; xfers != 0; xfers &= xfers - 1) {
+        int i = std::countr_zero(xfers);
+        command += (to_front >> i & 1) ? " f" : " b";
+        command += std::to_string(i);
+    }
+    command += "; rack ";
+    command += std::to_string(racking);
+    return command;
+}
+
+std::string Action::knitout(char from) const {
+    std::string knitout;
+    for (unsigned long long xfers = to_front | to_back; xfers != 0; xfers &= xfers - 1) {
+        int i = std::countr_zero(xfers);
+        std::string front = std::to_string(i);
+        std::string back = std::to_string(i - from);
+        if (to_front >> i & 1) {
+            knitout += "xfer b";
+            knitout += back;
+            knitout += " f";
+            knitout += front;
+        }
+        else {
+            knitout += "xfer f";
+            knitout += front;
+            knitout += " b";
+            knitout += back;
+        }
+        knitout += "\n";
+    }
+    if (racking != from) {
+        knitout += "rack ";
+        knitout += std::to_string(racking);
+        knitout += "\n";
+    }
+    return knitout;
+}
+
 KnittingState::KnittingState() :
-    braid(1)
+    braid(1),
+    offset_counts(),
+    offset_bits(0)
+{ }
+KnittingState::KnittingState(const allocator_type& allocator) :
+    back_needles(allocator),
+    front_needles(allocator),
+    braid(1),
+    slack_constraints(allocator),
+    offset_counts(),
+    offset_bits(0)
 { }
 
 KnittingState::KnittingState(
@@ -137,7 +199,9 @@ KnittingState::KnittingState(
 ) :
     machine(machine),
     braid(braid),
-    slack_constraints(slack_constraints)
+    slack_constraints(slack_constraints.begin(), slack_constraints.end()),
+    offset_counts(),
+    offset_bits(0)
 {
     for (char i = 0; i < machine.width; i++) {
         back_needles.emplace_back(back_loop_counts[i]);
@@ -147,19 +211,24 @@ KnittingState::KnittingState(
 }
 
 KnittingState::KnittingState(const KnittingState& other) :
+    KnittingState(other, allocator_type())
+{ }
+KnittingState::KnittingState(const KnittingState& other, const allocator_type& allocator) :
     machine(other.machine),
-    back_needles(other.back_needles),
-    front_needles(other.front_needles),
+    back_needles(other.back_needles, allocator),
+    front_needles(other.front_needles, allocator),
     braid(other.braid),
-    slack_constraints(other.slack_constraints),
-    target(other.target)
+    slack_constraints(other.slack_constraints, allocator),
+    target(other.target),
+    offset_counts(other.offset_counts),
+    offset_bits(other.offset_bits)
 { }
 
 void KnittingState::calculate_destinations() {
     auto permutation = braid.GetPerm();
 
     int j = 0;
-    for (char i = 0; i < 2*machine.width; i++) {
+    for (int i = 0; i < 2*machine.width; i++) {
         NeedleLabel needle = machine[i];
 
         if (loop_count(needle) > 1) {
@@ -171,6 +240,35 @@ void KnittingState::calculate_destinations() {
             j++;
         }
     }
+
+    calculate_offsets();
+}
+
+void KnittingState::calculate_offsets() {
+    offset_counts.fill(0);
+    offset_bits = 0;
+
+    for (int i = 0; i < 2*machine.width; i++) {
+        NeedleLabel needle = machine[i];
+        if (loop_count(needle) > 0) {
+            count_offset(needle.offset(destination(needle)), 1);
+        }
+    }
+}
+
+void KnittingState::count_offset(int off, int delta) {
+    if (off == 0 || off >= 32 || off < -32) {
+        return;
+    }
+
+    unsigned char& count = offset_counts[off+32];
+    count = (unsigned char)(count + delta);
+    if (count > 0) {
+        offset_bits |= 1ULL << (off+32);
+    }
+    else {
+        offset_bits &= ~(1ULL << (off+32));
+    }
 }
 
 char KnittingState::racking() const {
@@ -202,7 +300,7 @@ NeedleLabel KnittingState::destination(const NeedleLabel& n) const {
 }
 NeedleLabel KnittingState::needle_with_braid_rank(int rank) const {
     int j = 0;
-    for (char i = 0; i < 2*machine.width; i++) {
+    for (int i = 0; i < 2*machine.width; i++) {
         NeedleLabel needle = machine[i];
         j += loop_count(needle);
         if (j > rank) {
@@ -228,7 +326,7 @@ bool KnittingState::can_transfer(char loc) const {
 
     // find which needle this is
     int j = 0;
-    for (char i = 0; i < 2*machine.width; i++) {
+    for (int i = 0; i < 2*machine.width; i++) {
         NeedleLabel needle = machine[i];
         if (!needle.front && needle.i == loc - machine.racking) {
             break;
@@ -243,6 +341,8 @@ bool KnittingState::can_transfer(char loc) const {
 }
 
 bool KnittingState::transfer(char loc, bool to_front) {
+    PROFILE_SCOPE(Transfer);
+
     NeedleLabel back_needle = NeedleLabel(false, loc - machine.racking);
     NeedleLabel front_needle = NeedleLabel(true, loc);
 
@@ -253,7 +353,7 @@ bool KnittingState::transfer(char loc, bool to_front) {
 
         // find which needle this is
         int j = 0;
-        for (char i = 0; i < 2*machine.width; i++) {
+        for (int i = 0; i < 2*machine.width; i++) {
             NeedleLabel needle = machine[i];
             if (!needle.front && needle.i == loc - machine.racking) {
                 break;
@@ -270,6 +370,14 @@ bool KnittingState::transfer(char loc, bool to_front) {
         braid = braid.Merge(j+1);
     }
 
+    // only the needles involved in the transfer change their offsets
+    if (loop_count(front_needle) > 0) {
+        count_offset(front_needle.offset(destination(front_needle)), -1);
+    }
+    if (loop_count(back_needle) > 0) {
+        count_offset(back_needle.offset(destination(back_needle)), -1);
+    }
+
     if (to_front) {
         loop_count(front_needle) += loop_count(back_needle);
         destination(front_needle) = destination(back_needle);
@@ -287,10 +395,17 @@ bool KnittingState::transfer(char loc, bool to_front) {
         }
     }
 
+    NeedleLabel to_needle = to_front ? front_needle : back_needle;
+    if (loop_count(to_needle) > 0) {
+        count_offset(to_needle.offset(destination(to_needle)), 1);
+    }
+
     return true;
 }
 
 bool KnittingState::rack(char new_racking) {
+    PROFILE_SCOPE(Rack);
+
     if (new_racking > machine.max_racking || new_racking < machine.min_racking) {
         return false;
     }
@@ -307,7 +422,7 @@ bool KnittingState::rack(char new_racking) {
     cb::ArtinFactor f(braid.Index(), cb::ArtinFactor::Uninitialize, new_racking < machine.racking);
     std::vector<int> needle_positions (2*machine.width);
 
-    for (char i = 0, j = 0; i < 2*machine.width; i++) {
+    for (int i = 0, j = 0; i < 2*machine.width; i++) {
         NeedleLabel needle = machine[i];
         if (loop_count(needle) > 0) {
             needle_positions[needle.id()] = j;
@@ -315,7 +430,7 @@ bool KnittingState::rack(char new_racking) {
         }
     }
     machine.racking = new_racking;
-    for (char i = 0, j = 0; i < 2*machine.width; i++) {
+    for (int i = 0, j = 0; i < 2*machine.width; i++) {
         NeedleLabel needle = machine[i];
         if (loop_count(needle) > 0) {
             f[j + 1] = needle_positions[needle.id()] + 1;
@@ -356,21 +471,57 @@ KnittingState& KnittingState::operator=(const KnittingState& other) {
     braid = other.braid;
     slack_constraints = other.slack_constraints;
     target = other.target;
+    offset_counts = other.offset_counts;
+    offset_bits = other.offset_bits;
 
     return *this;
 }
 
 KnittingState::TransitionIterator::TransitionIterator(
     const KnittingState& prev,
-    bool canonicalize
+    bool canonicalize,
+    bool prune
 ) :
     canonicalize(canonicalize),
+    prune(prune),
     next_uncanonical(prev),
     prev(prev),
     next(prev)
 {
+    if (prev.machine.width > max_search_width) {
+        throw InvalidKnittingMachineException();
+    }
+    start();
+}
+
+void KnittingState::TransitionIterator::reset() {
+    next_uncanonical = prev;
+    start();
+}
+
+bool KnittingState::TransitionIterator::canonicalizes() const {
+    return canonicalize;
+}
+
+// enumerates from the first combination, with next_uncanonical == prev
+void KnittingState::TransitionIterator::start() {
     racking = prev.machine.min_racking;
     good = false;
+    remaining = std::numeric_limits<std::size_t>::max();
+    action.to_front = 0;
+    action.to_back = 0;
+    xfer_is.clear();
+    xfer_types.clear();
+    xfers.clear();
+    xfer_dominated.clear();
+
+    // an uncanonical state at prev's racking could be the target only if
+    // the target is uncanonical there
+    bool prune_xfers = canonicalize && prune && (
+        prev.target == nullptr ||
+        prev.target->machine.racking != prev.machine.racking ||
+        prev.target->canonical()
+    );
 
     for (
         char i = std::max('\0', prev.machine.racking);
@@ -384,15 +535,21 @@ KnittingState::TransitionIterator::TransitionIterator(
                 prev.loop_count(NeedleLabel(true, i)) > 0 &&
                 prev.loop_count(NeedleLabel(false, i - prev.machine.racking)) > 0
             );
+            // xfers[i] == 1 moves the front needle's loops to the back
+            xfer_dominated.push_back(prune_xfers && prev.loop_count(NeedleLabel(true, i)) > 0);
         }
     }
 
+    prune_no_xfers = canonicalize && prune && prev.canonical();
+    dominated = prune_no_xfers;
     done = xfers.empty();
-    xfer_command = "xfer none";
 }
 
 void KnittingState::TransitionIterator::increment_xfers() {
-    next_uncanonical = prev;
+    if (--remaining == 0) {
+        done = true;
+        return;
+    }
 
     for (unsigned int i = 0; i < xfers.size(); i++) {
         if (xfers[i] == (xfer_types[i] ? 2 : 1)) {
@@ -407,12 +564,22 @@ void KnittingState::TransitionIterator::increment_xfers() {
             break;
         }
     }
-    xfer_command = "xfer";
+    apply_xfers();
+}
+
+void KnittingState::TransitionIterator::apply_xfers() {
+    next_uncanonical = prev;
+    action.to_front = 0;
+    action.to_back = 0;
+    dominated = false;
+    bool transfers = false;
 
     for (unsigned int i = 0; i < xfers.size(); i++) {
         if (xfers[i] == 0) {
             continue;
         }
+        transfers = true;
+        dominated = dominated || (xfers[i] == 1 && xfer_dominated[i]);
         bool to_front = xfers[i] == 2;
 
         if (!to_front && prev.loop_count(NeedleLabel(true, xfer_is[i])) == 0) {
@@ -421,10 +588,44 @@ void KnittingState::TransitionIterator::increment_xfers() {
         }
 
         next_uncanonical.transfer(xfer_is[i], to_front);
-        xfer_command += (to_front ? " f" : " b") + std::to_string(xfer_is[i]);
+        (to_front ? action.to_front : action.to_back) |= 1ull << xfer_is[i];
+    }
+    if (!transfers) {
+        dominated = prune_no_xfers;
     }
 }
 
+std::size_t KnittingState::TransitionIterator::combinations() const {
+    if (xfers.empty()) {
+        return 0;
+    }
+    // saturating, for very wide beds
+    std::size_t n = 1;
+    for (bool three_choices : xfer_types) {
+        n = std::min(n, std::numeric_limits<std::size_t>::max() / 3) * (three_choices ? 3 : 2);
+    }
+    return n;
+}
+
+std::size_t KnittingState::TransitionIterator::max_transitions() const {
+    return combinations() * (std::size_t)(prev.machine.max_racking - prev.machine.min_racking + 1);
+}
+
+void KnittingState::TransitionIterator::restrict(std::size_t first, std::size_t count) {
+    remaining = count;
+    if (first >= combinations() || count == 0) {
+        done = true;
+        return;
+    }
+    // xfers is a mixed-radix counter, least significant digit first
+    for (unsigned int i = 0; i < xfers.size(); i++) {
+        std::size_t radix = xfer_types[i] ? 3 : 2;
+        xfers[i] = (char)(first % radix);
+        first /= radix;
+    }
+    apply_xfers();
+}
+
 bool KnittingState::TransitionIterator::try_next() {
     if (racking > prev.machine.max_racking) {
         increment_xfers();
@@ -434,7 +635,11 @@ bool KnittingState::TransitionIterator::try_next() {
         }
     }
 
-    command = xfer_command + "; rack " + std::to_string(racking);
+    action.racking = racking;
+    if (racking == prev.machine.racking && dominated) {
+        racking++;
+        return false;
+    }
 
     next = next_uncanonical;
     good = next.rack(racking);
@@ -459,25 +664,41 @@ bool KnittingState::TransitionIterator::has_next() {
     return false;
 }
 
+KnittingState::Undo::Undo() :
+    racking(0),
+    braid(1),
+    offset_counts(),
+    offset_bits(0)
+{ }
+
 KnittingState::Backpointer::Backpointer() {}
+KnittingState::Backpointer::Backpointer(const allocator_type& allocator) :
+    prev(allocator)
+{ }
 
 KnittingState::Backpointer::Backpointer(
-    const KnittingState& prev, const std::string& command
+    const KnittingState& prev, const Action& action
 ) :
     prev(prev),
-    command(command)
+    action(action)
 { }
 
 KnittingState::Backpointer::Backpointer(
     const KnittingState::Backpointer& other
 ) :
     prev(other.prev),
-    command(other.command)
+    action(other.action)
+{ }
+KnittingState::Backpointer::Backpointer(
+    const KnittingState::Backpointer& other, const allocator_type& allocator
+) :
+    prev(other.prev, allocator),
+    action(other.action)
 { }
 
 KnittingState::Backpointer& KnittingState::Backpointer::operator=(const KnittingState::Backpointer& other) {
     prev = other.prev;
-    command = other.command;
+    action = other.action;
     return *this;
 }
 
@@ -507,6 +728,8 @@ KnittingState::TransitionIterator KnittingState::canonical_adjacent() const {
 }
 
 bool KnittingState::canonicalize() {
+    PROFILE_SCOPE(Canonicalize);
+
     // don't canonicalize if we are at the target, and return false to
     // signal that we didn't canonicalize
     if (target != nullptr && *this == *target) {
@@ -528,6 +751,59 @@ bool KnittingState::canonicalize() {
     return true;
 }
 
+bool KnittingState::canonical() const {
+    for (
+        char i = std::max('\0', machine.racking);
+        i < machine.width + std::min('\0', machine.racking);
+        i++
+    ) {
+        if (
+            loop_count(NeedleLabel(false, i - machine.racking)) > 0 &&
+            loop_count(NeedleLabel(true, i)) == 0
+        ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool KnittingState::make(const Action& action, bool canonicalize, Undo& undo) {
+    undo.racking = machine.racking;
+    undo.back_needles = back_needles;
+    undo.front_needles = front_needles;
+    undo.braid = braid;
+    undo.slack_constraints = slack_constraints;
+    undo.offset_counts = offset_counts;
+    undo.offset_bits = offset_bits;
+
+    // in order of location, as TransitionIterator transfers
+    for (char i = 0; i < std::min(machine.width, max_search_width); i++) {
+        if (action.to_front >> i & 1) {
+            transfer(i, true);
+        }
+        else if (action.to_back >> i & 1) {
+            transfer(i, false);
+        }
+    }
+    if (!rack(action.racking)) {
+        return false;
+    }
+    if (canonicalize) {
+        this->canonicalize();
+    }
+    return true;
+}
+
+void KnittingState::unmake(const Undo& undo) {
+    machine.racking = undo.racking;
+    back_needles = undo.back_needles;
+    front_needles = undo.front_needles;
+    braid = undo.braid;
+    slack_constraints = undo.slack_constraints;
+    offset_counts = undo.offset_counts;
+    offset_bits = undo.offset_bits;
+}
+
 unsigned int KnittingState::no_heuristic() const {
     return 0;
 }
@@ -546,22 +822,135 @@ unsigned int KnittingState::braid_heuristic() const {
     return target_heuristic();
 }
 
-unsigned long long KnittingState::offsets() const {
-    unsigned long long offs = 0;
+std::size_t braid_heap_bytes(const cb::ArtinBraid& braid) {
+    // list nodes holding factors, each with a permutation table
+    return braid.FactorList.size() * (
+        2*sizeof(void*) + sizeof(cb::ArtinFactor) + (std::size_t)(braid.Index() + 1)*sizeof(int)
+    );
+}
 
-    for (char i = 0; i < 2*machine.width; i++) {
-        NeedleLabel needle = machine[i];
-        if (loop_count(needle) == 0) {
-            continue;
+cb::ArtinBraid make_braid(
+    int index, int left_delta, const std::vector<cb::ArtinFactor>& factors
+) {
+    cb::ArtinBraid braid(index);
+    for (auto it = factors.rbegin(); it != factors.rend(); it++) {
+        braid.LeftMultiply(*it);
+    }
+    for (int k = 0; k < std::abs(left_delta); k++) {
+        braid.LeftMultiply(cb::ArtinFactor(index, 1, left_delta < 0));
+    }
+    braid.MakeMCF();
+    return braid;
+}
+
+static unsigned char read_byte(std::string_view bytes, std::size_t& pos) {
+    if (pos >= bytes.size()) {
+        throw InvalidEncodingException();
+    }
+    return (unsigned char)bytes[pos++];
+}
+
+// index, left delta (4 bytes), factor count (2 bytes), then each factor's
+// permutation of 1..index
+void encode_braid(std::string& bytes, const cb::ArtinBraid& braid) {
+    cb::ArtinBraid lcf = braid;
+    lcf.MakeLCF();
+
+    bytes += (char)lcf.Index();
+    for (int k = 0; k < 4; k++) {
+        bytes += (char)(((unsigned int)lcf.LeftDelta >> (8*k)) & 0xff);
+    }
+    bytes += (char)(lcf.FactorList.size() & 0xff);
+    bytes += (char)(lcf.FactorList.size() >> 8);
+    for (const auto& factor : lcf.FactorList) {
+        for (int i = 1; i <= lcf.Index(); i++) {
+            bytes += (char)factor[i];
+        }
+    }
+}
+
+cb::ArtinBraid decode_braid(std::string_view bytes, std::size_t& pos) {
+    int index = read_byte(bytes, pos);
+    unsigned int left_delta = 0;
+    for (int k = 0; k < 4; k++) {
+        left_delta |= (unsigned int)read_byte(bytes, pos) << (8*k);
+    }
+    int factor_count = read_byte(bytes, pos);
+    factor_count |= read_byte(bytes, pos) << 8;
+
+    std::vector<cb::ArtinFactor> factors;
+    for (int f = 0; f < factor_count; f++) {
+        cb::ArtinFactor factor(index, cb::ArtinFactor::Uninitialize);
+        for (int i = 1; i <= index; i++) {
+            factor[i] = read_byte(bytes, pos);
         }
+        factors.push_back(factor);
+    }
+    return make_braid(index, (int)left_delta, factors);
+}
+
+std::size_t KnittingState::heap_bytes() const {
+    return (back_needles.capacity() + front_needles.capacity())*sizeof(Needle)
+         + slack_constraints.capacity()*sizeof(SlackConstraint)
+         + braid_heap_bytes(braid);
+}
 
-        int off = needle.offset(destination(needle));
-        if (off != 0 && off < 32 && off >= -32) {
-            offs |= 1ULL << (off+32);
+// racking, then the count of every back and front needle and, if it is
+// loaded, its destination (transfer leaves an emptied needle's, which
+// operator== ignores), the braid, and the slack constraints as they have
+// been moved by transfers
+std::string KnittingState::encode() const {
+    std::string bytes;
+    bytes += machine.racking;
+    for (const Bed* bed : { &back_needles, &front_needles }) {
+        for (const Needle& needle : *bed) {
+            bytes += needle.count;
+            if (needle.count > 0) {
+                bytes += (char)needle.destination.front;
+                bytes += needle.destination.i;
+            }
         }
     }
+    encode_braid(bytes, braid);
+    for (const SlackConstraint& constraint : slack_constraints) {
+        bytes += (char)constraint.needle_1.front;
+        bytes += constraint.needle_1.i;
+        bytes += (char)constraint.needle_2.front;
+        bytes += constraint.needle_2.i;
+        bytes += constraint.limit;
+    }
+    return bytes;
+}
+
+void KnittingState::decode(std::string_view bytes) {
+    std::size_t pos = 0;
+    machine.racking = (char)read_byte(bytes, pos);
+    for (Bed* bed : { &back_needles, &front_needles }) {
+        for (Needle& needle : *bed) {
+            needle.count = (char)read_byte(bytes, pos);
+            needle.destination = NeedleLabel();
+            if (needle.count > 0) {
+                needle.destination.front = read_byte(bytes, pos);
+                needle.destination.i = (char)read_byte(bytes, pos);
+            }
+        }
+    }
+    braid = decode_braid(bytes, pos);
+    for (SlackConstraint& constraint : slack_constraints) {
+        constraint.needle_1.front = read_byte(bytes, pos);
+        constraint.needle_1.i = (char)read_byte(bytes, pos);
+        constraint.needle_2.front = read_byte(bytes, pos);
+        constraint.needle_2.i = (char)read_byte(bytes, pos);
+        constraint.limit = (char)read_byte(bytes, pos);
+    }
+    if (pos != bytes.size()) {
+        throw InvalidEncodingException();
+    }
+    calculate_offsets();
+}
 
-    return offs;
+unsigned long long KnittingState::offsets() const {
+    return offset_bits;
 }
 
 unsigned int KnittingState::log_heuristic() const {
@@ -1,4 +1,9 @@
 #include "cbraid.h"
+#include <array>
+#include <limits>
+#include <memory_resource>
+#include <string>
+#include <string_view>
 #include <vector>
 #include <random>
 
@@ -29,6 +34,19 @@ class InvalidKnittingMachineException { };
 class InvalidRackingException { };
 class InvalidTargetStateException { };
 class InvalidBraidRankException { };
+class InvalidEncodingException { };
+
+// approximate bytes a braid owns outside the object
+std::size_t braid_heap_bytes(const cb::ArtinBraid&);
+
+// Delta^left_delta followed by the factors, in the mixed canonical form
+// the states keep
+cb::ArtinBraid make_braid(int index, int left_delta, const std::vector<cb::ArtinFactor>&);
+
+// A braid's left canonical form packed into bytes, appended by
+// encode_braid and read back from position pos, which is advanced past it
+void encode_braid(std::string&, const cb::ArtinBraid&);
+cb::ArtinBraid decode_braid(std::string_view, std::size_t& pos);
 
 class NeedleLabel {
 public:
@@ -69,7 +87,8 @@ public:
     KnittingMachine(char = 1, char = 0, char = 0, char = 0);
     KnittingMachine(const KnittingMachine&);
 
-    NeedleLabel operator[](char) const;
+    // the needles in bed order, for i in [0, 2*width)
+    NeedleLabel operator[](int) const;
 };
 
 class SlackConstraint {
@@ -85,23 +104,59 @@ public:
     SlackConstraint& operator=(const SlackConstraint&);
 };
 
+// the widest bed whose states' transitions can be enumerated, the width
+// of Action's masks; wider beds are planned in windows (see windowed.h)
+constexpr char max_search_width = 64;
+
+// One transition: the transfers made at the current racking, as bitmasks
+// over front needle indices, followed by racking to `racking`. It is
+// plain data so the search can carry it for every successor; text is only
+// produced for the final path.
+class Action {
+public:
+    unsigned long long to_front;
+    unsigned long long to_back;
+    char racking;
+
+    Action(unsigned long long = 0, unsigned long long = 0, char = 0);
+
+    // "xfer f3 b5; rack 2", as read by Plan::apply
+    std::string command() const;
+    // the knitout for this action, taken at racking `from`
+    std::string knitout(char from) const;
+};
+
+// The states are allocator-aware: copies made with an allocator keep their
+// beds/loops and slack constraints in its memory resource (a search's
+// arena), while plain copies use the default resource, so a state copied
+// out of a search outlives the arena. The braid is allocated by cbraid.
 class KnittingState {
 public:
-    using Bed = std::vector<Needle>;
+    using Bed = std::pmr::vector<Needle>;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
 
     class TransitionIterator;
     class Backpointer;
+    class Undo;
 private:
     KnittingMachine machine;
     Bed back_needles;
     Bed front_needles;
     cb::ArtinBraid braid;
-    std::vector<SlackConstraint> slack_constraints;
+    std::pmr::vector<SlackConstraint> slack_constraints;
     KnittingState* target;
 
+    // number of loaded needles at each offset in [-32, 32) from their
+    // destination, and the corresponding bitset returned by offsets()
+    std::array<unsigned char, 64> offset_counts;
+    unsigned long long offset_bits;
+
     void calculate_destinations();
+    void calculate_offsets();
+    void count_offset(int, int);
 public:
     KnittingState();
+    explicit KnittingState(const allocator_type&);
     KnittingState(
         const KnittingMachine,
         const std::vector<char>&,
@@ -111,6 +166,7 @@ public:
         KnittingState* = nullptr
     );
     KnittingState(const KnittingState&);
+    KnittingState(const KnittingState&, const allocator_type&);
 
     char racking() const;
 
@@ -140,8 +196,28 @@ public:
     TransitionIterator canonical_adjacent() const;
 
     bool canonicalize();
+    // whether canonicalize would move no loops
+    bool canonical() const;
+    // Takes an action in place, as the transition that enumerated it
+    // did: its transfers, the rack, then canonicalize if canonicalize.
+    // The parts it changes are first saved to undo, for unmake to put
+    // back; an Undo reused for each make keeps their storage, so only
+    // racking and merging braids allocate. false if the rack is not
+    // allowed (unmake still restores the state).
+    bool make(const Action&, bool canonicalize, Undo&);
+    void unmake(const Undo&);
 
     unsigned long long offsets() const;
+    // approximate bytes owned outside the object, for search memory budgets
+    std::size_t heap_bytes() const;
+
+    // The parts of the state a search changes, packed for external::a_star
+    // and search::compressed_a_star; decode replaces them, keeping this
+    // state's machine bounds, target and (for LM21) slack constraints.
+    // Equal states have equal encodings, and equal encodings are equal
+    // states.
+    std::string encode() const;
+    void decode(std::string_view);
 
     unsigned int no_heuristic() const;
     unsigned int target_heuristic() const;
@@ -155,39 +231,90 @@ public:
     friend std::size_t std::hash<KnittingState>::operator()(const KnittingState&) const;
 };
 
+// With canonicalize, each transition ends with canonicalize, which moves
+// the loops of every back needle opposite an empty front needle to the
+// front. So without racking, transferring a front needle's loops to the
+// back (alone, or merged with the back needle's) reaches the same state as
+// leaving them (or merging to the front) at no lower weight, and
+// transferring nothing reaches prev again if it is canonical. Unless the
+// iterator is constructed with prune false (e.g. to check that pruning
+// leaves plans optimal), those transitions are skipped before their states
+// are built, except where the target itself has loops canonicalize would
+// move: canonicalize leaves the target alone.
 class KnittingState::TransitionIterator {
     char racking;
     std::vector<char> xfer_is;
     std::vector<bool> xfer_types; // false => 2 choices; true => 3 choices
     std::vector<char> xfers; // xfer actions: 0 => nothing; 1 => xfer_to_back; 2 => xfer_to_front
-    std::string xfer_command;
     bool canonicalize;
+    bool prune;
     bool good;
     bool done;
+    // transfer combinations left to enumerate
+    std::size_t remaining = std::numeric_limits<std::size_t>::max();
+    // whether xfers[i] == 1 is dominated at prev's racking, and whether
+    // the current combination is
+    std::vector<bool> xfer_dominated;
+    bool prune_no_xfers;
+    bool dominated;
     KnittingState next_uncanonical;
 
+    void start();
     void increment_xfers();
+    void apply_xfers();
     bool try_next();
 public:
     const KnittingState& prev;
     int weight = 1;
     KnittingState next;
-    std::string command;
+    Action action;
 
-    TransitionIterator(const KnittingState&, bool);
+    TransitionIterator(const KnittingState&, bool canonicalize, bool prune = true);
 
     bool has_next();
+    // Starts over with the transitions of prev as it is now, reusing this
+    // iterator's storage, for searches that change prev in place (make).
+    void reset();
+    bool canonicalizes() const;
+
+    // The number of transfer combinations, each tried at every racking,
+    // and so an upper bound on the transitions (max_transitions).
+    std::size_t combinations() const;
+    std::size_t max_transitions() const;
+    // Limits the transitions to those of the combinations [first, first +
+    // count), in the order has_next enumerates them, so that one state's
+    // transitions can be split between threads. Call before has_next.
+    void restrict(std::size_t first, std::size_t count);
 };
 
 
+// What KnittingState::make changes, as it was before.
+class KnittingState::Undo {
+    char racking;
+    Bed back_needles;
+    Bed front_needles;
+    cb::ArtinBraid braid;
+    std::pmr::vector<SlackConstraint> slack_constraints;
+    std::array<unsigned char, 64> offset_counts;
+    unsigned long long offset_bits;
+
+    friend class KnittingState;
+public:
+    Undo();
+};
+
 class KnittingState::Backpointer {
 public:
+    using allocator_type = KnittingState::allocator_type;
+
     KnittingState prev;
-    std::string command;
+    Action action;
 
     Backpointer();
-    Backpointer(const KnittingState&, const std::string&);
+    explicit Backpointer(const allocator_type&);
+    Backpointer(const KnittingState&, const Action&);
     Backpointer(const KnittingState::Backpointer&);
+    Backpointer(const KnittingState::Backpointer&, const allocator_type&);
     KnittingState::Backpointer& operator=(const KnittingState::Backpointer&);
 };
 
@@ -206,6 +333,8 @@ class KnittingStateLM21 {
 public:
     class TransitionIterator;
     class Backpointer;
+    class Undo;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
 
     friend TestCase simple_tube (
         KnittingMachine machine, int loop_count, int pass_count, std::mt19937& rng
@@ -214,15 +343,23 @@ public:
 private:
     KnittingMachine machine;
     cb::ArtinBraid braid;
-    std::vector<NeedleLabel> loop_locations;
-    std::vector<LoopSlackConstraint> slack_constraints;
+    std::pmr::vector<NeedleLabel> loop_locations;
+    std::pmr::vector<LoopSlackConstraint> slack_constraints;
     KnittingStateLM21* target;
     bool only_contractions;
 
+    // number of loops at each offset in [-32, 32) from their target
+    // location, and the corresponding bitset returned by offsets()
+    std::array<unsigned char, 64> offset_counts;
+    unsigned long long offset_bits;
+
     void calculate_destinations();
+    void calculate_offsets();
+    void count_offset(int, int);
 
 public:
     KnittingStateLM21();
+    explicit KnittingStateLM21(const allocator_type&);
     KnittingStateLM21(
         const KnittingMachine,
         const std::vector<char>&,
@@ -233,6 +370,7 @@ public:
         bool = false
     );
     KnittingStateLM21(const KnittingStateLM21&);
+    KnittingStateLM21(const KnittingStateLM21&, const allocator_type&);
 
     char racking() const;
     bool needle_empty(NeedleLabel) const;
@@ -258,8 +396,19 @@ public:
     TransitionIterator canonical_adjacent() const;
 
     bool canonicalize();
+    // whether canonicalize would move no loops
+    bool canonical() const;
+    // as for KnittingState
+    bool make(const Action&, bool canonicalize, Undo&);
+    void unmake(const Undo&);
 
     unsigned long long offsets() const;
+    // approximate bytes owned outside the object, for search memory budgets
+    std::size_t heap_bytes() const;
+
+    // see KnittingState::encode
+    std::string encode() const;
+    void decode(std::string_view);
 
     unsigned int no_heuristic() const;
     unsigned int target_heuristic() const;
@@ -278,34 +427,74 @@ class KnittingStateLM21::TransitionIterator {
     std::vector<char> xfer_is;
     std::vector<bool> xfer_types;
     std::vector<char> xfers;
-    std::string xfer_command;
     bool canonicalize;
+    bool prune;
     bool good;
     bool done;
+    // transfer combinations left to enumerate
+    std::size_t remaining = std::numeric_limits<std::size_t>::max();
+    // whether xfers[i] == 1 is dominated at prev's racking, and whether
+    // the current combination is
+    std::vector<bool> xfer_dominated;
+    bool prune_no_xfers;
+    bool dominated;
     KnittingStateLM21 next_uncanonical;
 
+    void start();
     void increment_xfers();
+    void apply_xfers();
     bool try_next();
 public:
     const KnittingStateLM21& prev;
     int weight;
     KnittingStateLM21 next;
-    std::string command;
+    Action action;
 
-    TransitionIterator(const KnittingStateLM21&, bool);
+    TransitionIterator(const KnittingStateLM21&, bool canonicalize, bool prune = true);
 
     bool has_next();
+    // Starts over with the transitions of prev as it is now, reusing this
+    // iterator's storage, for searches that change prev in place (make).
+    void reset();
+    bool canonicalizes() const;
+
+    // The number of transfer combinations, each tried at every racking,
+    // and so an upper bound on the transitions (max_transitions).
+    std::size_t combinations() const;
+    std::size_t max_transitions() const;
+    // Limits the transitions to those of the combinations [first, first +
+    // count), in the order has_next enumerates them, so that one state's
+    // transitions can be split between threads. Call before has_next.
+    void restrict(std::size_t first, std::size_t count);
     KnittingStateLM21 random(std::mt19937&);
 };
 
+// What KnittingStateLM21::make changes, as it was before: transfers move
+// loops without changing their slack constraints.
+class KnittingStateLM21::Undo {
+    char racking;
+    cb::ArtinBraid braid;
+    std::pmr::vector<NeedleLabel> loop_locations;
+    std::array<unsigned char, 64> offset_counts;
+    unsigned long long offset_bits;
+
+    friend class KnittingStateLM21;
+public:
+    Undo();
+};
+
 class KnittingStateLM21::Backpointer {
 public:
+    using allocator_type = KnittingStateLM21::allocator_type;
+
     KnittingStateLM21 prev;
-    std::string command;
+    Action action;
 
     Backpointer();
-    Backpointer(const KnittingStateLM21&, const std::string&);
+    explicit Backpointer(const allocator_type&);
+    Backpointer(const KnittingStateLM21&, const Action&);
     Backpointer(const KnittingStateLM21::Backpointer&);
+    Backpointer(const KnittingStateLM21::Backpointer&, const allocator_type&);
     KnittingStateLM21::Backpointer& operator=(const KnittingStateLM21::Backpointer&);
 };
 
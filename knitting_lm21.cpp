@@ -1,6 +1,7 @@
 #include <bit>
 #include "knitting.h"
 #include "prebuilt.h"
+#include "profile.h"
 #include "util.h"
 
 
@@ -18,7 +19,16 @@ bool LoopSlackConstraint::respected(NeedleLabel needle_1, NeedleLabel needle_2,
 
 
 KnittingStateLM21::KnittingStateLM21() :
-    braid(1)
+    braid(1),
+    offset_counts(),
+    offset_bits(0)
+{ }
+KnittingStateLM21::KnittingStateLM21(const allocator_type& allocator) :
+    braid(1),
+    loop_locations(allocator),
+    slack_constraints(allocator),
+    offset_counts(),
+    offset_bits(0)
 { }
 KnittingStateLM21::KnittingStateLM21(
     const KnittingMachine machine,
@@ -32,11 +42,13 @@ KnittingStateLM21::KnittingStateLM21(
     machine(machine),
     braid(braid),
     loop_locations(braid.Index()),
-    only_contractions(only_contractions)
+    only_contractions(only_contractions),
+    offset_counts(),
+    offset_bits(0)
 {
     auto permutation = braid.GetPerm();
 
-    for (char i = 0, j = 0; i < 2*machine.width; i++) {
+    for (int i = 0, j = 0; i < 2*machine.width; i++) {
         NeedleLabel needle = machine[i];
         const std::vector<char>& loop_counts = needle.front ? front_loop_counts : back_loop_counts;
         int loop_count = loop_counts[needle.i];
@@ -59,12 +71,19 @@ KnittingStateLM21::KnittingStateLM21(
     set_target(target);
 }
 KnittingStateLM21::KnittingStateLM21(const KnittingStateLM21& other) :
+    KnittingStateLM21(other, allocator_type())
+{ }
+KnittingStateLM21::KnittingStateLM21(
+    const KnittingStateLM21& other, const allocator_type& allocator
+) :
     machine(other.machine),
     braid(other.braid),
-    loop_locations(other.loop_locations),
-    slack_constraints(other.slack_constraints),
+    loop_locations(other.loop_locations, allocator),
+    slack_constraints(other.slack_constraints, allocator),
     target(other.target),
-    only_contractions(other.only_contractions)
+    only_contractions(other.only_contractions),
+    offset_counts(other.offset_counts),
+    offset_bits(other.offset_bits)
 { }
 
 char KnittingStateLM21::racking() const {
@@ -97,6 +116,34 @@ void KnittingStateLM21::set_target(KnittingStateLM21* t) {
             throw InvalidTargetStateException();
         }
     }
+    calculate_offsets();
+}
+
+void KnittingStateLM21::calculate_offsets() {
+    offset_counts.fill(0);
+    offset_bits = 0;
+
+    if (target == nullptr) {
+        return;
+    }
+    for (unsigned char i = 0; i < loop_locations.size(); i++) {
+        count_offset(loop_locations[i].offset(target->loop_locations[i]), 1);
+    }
+}
+
+void KnittingStateLM21::count_offset(int off, int delta) {
+    if (off == 0 || off >= 32 || off < -32) {
+        return;
+    }
+
+    unsigned char& count = offset_counts[off+32];
+    count = (unsigned char)(count + delta);
+    if (count > 0) {
+        offset_bits |= 1ULL << (off+32);
+    }
+    else {
+        offset_bits &= ~(1ULL << (off+32));
+    }
 }
 bool KnittingStateLM21::can_transfer(char loc) const {
     NeedleLabel back_needle = NeedleLabel(false, loc - machine.racking);
@@ -147,6 +194,8 @@ std::vector<char> KnittingStateLM21::front_bed() const {
 }
 
 bool KnittingStateLM21::rack(char new_racking) {
+    PROFILE_SCOPE(Rack);
+
     if (new_racking > machine.max_racking || new_racking < machine.min_racking) {
         return false;
     }
@@ -165,14 +214,14 @@ bool KnittingStateLM21::rack(char new_racking) {
     cb::ArtinFactor f(braid.Index(), cb::ArtinFactor::Uninitialize, new_racking < machine.racking);
     std::vector<int> needle_positions (2*machine.width);
 
-    for (char i = 0, j = 0; i < 2*machine.width; i++) {
+    for (int i = 0, j = 0; i < 2*machine.width; i++) {
         NeedleLabel needle = machine[i];
         needle_positions[needle.id()] = j;
         j += loop_count(needle);
     }
     machine.racking = new_racking;
 
-    for (char i = 0, j = 0; i < 2*machine.width; i++) {
+    for (int i = 0, j = 0; i < 2*machine.width; i++) {
         NeedleLabel needle = machine[i];
         char count = loop_count(needle);
 
@@ -187,15 +236,21 @@ bool KnittingStateLM21::rack(char new_racking) {
     return true;
 }
 bool KnittingStateLM21::transfer(char loc, bool to_front) {
+    PROFILE_SCOPE(Transfer);
+
     NeedleLabel back_needle = NeedleLabel(false, loc - machine.racking);
     NeedleLabel front_needle = NeedleLabel(true, loc);
 
     NeedleLabel to_needle = to_front ? front_needle : back_needle;
     NeedleLabel from_needle = to_front ? back_needle : front_needle;
 
-    for (auto& needle : loop_locations) {
-        if (needle == from_needle) {
-            needle = to_needle;
+    for (unsigned char i = 0; i < loop_locations.size(); i++) {
+        if (loop_locations[i] == from_needle) {
+            if (target != nullptr) {
+                count_offset(from_needle.offset(target->loop_locations[i]), -1);
+                count_offset(to_needle.offset(target->loop_locations[i]), 1);
+            }
+            loop_locations[i] = to_needle;
         }
     }
 
@@ -218,6 +273,8 @@ KnittingStateLM21& KnittingStateLM21::operator=(const KnittingStateLM21& other)
     slack_constraints = other.slack_constraints;
     target = other.target;
     only_contractions = other.only_contractions;
+    offset_counts = other.offset_counts;
+    offset_bits = other.offset_bits;
 
     return *this;
 }
@@ -247,6 +304,8 @@ KnittingStateLM21::TransitionIterator KnittingStateLM21::canonical_adjacent() co
 }
 
 bool KnittingStateLM21::canonicalize() {
+    PROFILE_SCOPE(Canonicalize);
+
     if (target != nullptr && *this == *target) {
         return false;
     }
@@ -265,17 +324,94 @@ bool KnittingStateLM21::canonicalize() {
     return true;
 }
 
-unsigned long long KnittingStateLM21::offsets() const {
-    unsigned long long offs = 0;
+bool KnittingStateLM21::canonical() const {
+    for (
+        char i = std::max('\0', machine.racking);
+        i < machine.width + std::min('\0', machine.racking);
+        i++
+    ) {
+        if (
+            needle_empty(NeedleLabel(true, i)) &&
+            !needle_empty(NeedleLabel(false, i - machine.racking))
+        ) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    for (unsigned char i = 0; i < loop_locations.size(); i++) {
-        int off = loop_locations[i].offset(target->loop_locations[i]);
-        if (off != 0 && off < 32 && off >= -32) {
-            offs |= 1ULL << (off+32);
+bool KnittingStateLM21::make(const Action& action, bool canonicalize, Undo& undo) {
+    undo.racking = machine.racking;
+    undo.braid = braid;
+    undo.loop_locations = loop_locations;
+    undo.offset_counts = offset_counts;
+    undo.offset_bits = offset_bits;
+
+    for (char i = 0; i < std::min(machine.width, max_search_width); i++) {
+        if (action.to_front >> i & 1) {
+            transfer(i, true);
+        }
+        else if (action.to_back >> i & 1) {
+            transfer(i, false);
+        }
+    }
+    if (!rack(action.racking)) {
+        return false;
+    }
+    if (canonicalize) {
+        this->canonicalize();
+    }
+    return true;
+}
+
+void KnittingStateLM21::unmake(const Undo& undo) {
+    machine.racking = undo.racking;
+    braid = undo.braid;
+    loop_locations = undo.loop_locations;
+    offset_counts = undo.offset_counts;
+    offset_bits = undo.offset_bits;
+}
+
+std::size_t KnittingStateLM21::heap_bytes() const {
+    return loop_locations.capacity()*sizeof(NeedleLabel)
+         + slack_constraints.capacity()*sizeof(LoopSlackConstraint)
+         + braid_heap_bytes(braid);
+}
+
+// racking, each loop's needle id, then the braid
+std::string KnittingStateLM21::encode() const {
+    std::string bytes;
+    bytes += machine.racking;
+    bytes += (char)loop_locations.size();
+    for (const NeedleLabel& needle : loop_locations) {
+        bytes += (char)needle.id();
+    }
+    encode_braid(bytes, braid);
+    return bytes;
+}
+
+void KnittingStateLM21::decode(std::string_view bytes) {
+    if (bytes.size() < 2 || (unsigned char)bytes[1] != loop_locations.size()) {
+        throw InvalidEncodingException();
+    }
+    machine.racking = bytes[0];
+    std::size_t pos = 2;
+    for (NeedleLabel& needle : loop_locations) {
+        if (pos >= bytes.size()) {
+            throw InvalidEncodingException();
         }
+        int id = (unsigned char)bytes[pos++];
+        needle = NeedleLabel(id % 2 == 1, (char)(id / 2));
+    }
+    braid = decode_braid(bytes, pos);
+    if (pos != bytes.size()) {
+        throw InvalidEncodingException();
     }
+    calculate_offsets();
+}
 
-    return offs;
+unsigned long long KnittingStateLM21::offsets() const {
+    return offset_bits;
 }
 
 unsigned int KnittingStateLM21::no_heuristic() const {
@@ -311,15 +447,47 @@ unsigned int KnittingStateLM21::braid_prebuilt_heuristic() const {
 
 KnittingStateLM21::TransitionIterator::TransitionIterator(
     const KnittingStateLM21& prev,
-    bool canonicalize
+    bool canonicalize,
+    bool prune
 ) :
     canonicalize(canonicalize),
+    prune(prune),
     next_uncanonical(prev),
     prev(prev),
     next(prev)
 {
+    if (prev.machine.width > max_search_width) {
+        throw InvalidKnittingMachineException();
+    }
+    start();
+}
+
+void KnittingStateLM21::TransitionIterator::reset() {
+    next_uncanonical = prev;
+    start();
+}
+
+bool KnittingStateLM21::TransitionIterator::canonicalizes() const {
+    return canonicalize;
+}
+
+void KnittingStateLM21::TransitionIterator::start() {
     racking = prev.machine.min_racking;
     good = false;
+    remaining = std::numeric_limits<std::size_t>::max();
+    action.to_front = 0;
+    action.to_back = 0;
+    xfer_is.clear();
+    xfer_types.clear();
+    xfers.clear();
+    xfer_dominated.clear();
+
+    // as for KnittingState
+    bool prune_xfers = canonicalize && prune && (
+        prev.target == nullptr ||
+        prev.target->machine.racking != prev.machine.racking ||
+        prev.target->canonical()
+    );
 
     for (
         char i = std::max('\0', prev.machine.racking);
@@ -333,18 +501,22 @@ KnittingStateLM21::TransitionIterator::TransitionIterator(
                 !prev.needle_empty(NeedleLabel(true, i)) &&
                 !prev.needle_empty(NeedleLabel(false, i - prev.machine.racking))
             );
+            xfer_dominated.push_back(prune_xfers && !prev.needle_empty(NeedleLabel(true, i)));
         }
     }
 
+    prune_no_xfers = canonicalize && prune && prev.canonical();
+    dominated = prune_no_xfers;
     done = xfers.empty();
-    xfer_command = "xfer none";
 }
 
 void KnittingStateLM21::TransitionIterator::increment_xfers() {
-    next_uncanonical = prev;
+    if (--remaining == 0) {
+        done = true;
+        return;
+    }
 
     for (unsigned int i = 0; i < xfers.size(); i++) {
-
         if (xfers[i] == (xfer_types[i] ? 2 : 1)) {
             xfers[i] = 0;
             if (i + 1 == xfer_is.size()) {
@@ -357,12 +529,22 @@ void KnittingStateLM21::TransitionIterator::increment_xfers() {
             break;
         }
     }
-    xfer_command = "xfer";
+    apply_xfers();
+}
+
+void KnittingStateLM21::TransitionIterator::apply_xfers() {
+    next_uncanonical = prev;
+    action.to_front = 0;
+    action.to_back = 0;
+    dominated = false;
+    bool transfers = false;
 
     for (unsigned int i = 0; i < xfers.size(); i++) {
         if (xfers[i] == 0) {
             continue;
         }
+        transfers = true;
+        dominated = dominated || (xfers[i] == 1 && xfer_dominated[i]);
         bool to_front = xfers[i] == 2;
 
         if (!to_front && prev.loop_count(NeedleLabel(true, xfer_is[i])) == 0) {
@@ -371,8 +553,42 @@ void KnittingStateLM21::TransitionIterator::increment_xfers() {
         }
 
         next_uncanonical.transfer(xfer_is[i], to_front);
-        xfer_command += (to_front ? " f" : " b") + std::to_string(xfer_is[i]);
+        (to_front ? action.to_front : action.to_back) |= 1ull << xfer_is[i];
+    }
+    if (!transfers) {
+        dominated = prune_no_xfers;
+    }
+}
+
+std::size_t KnittingStateLM21::TransitionIterator::combinations() const {
+    if (xfers.empty()) {
+        return 0;
+    }
+    // saturating, for very wide beds
+    std::size_t n = 1;
+    for (bool three_choices : xfer_types) {
+        n = std::min(n, std::numeric_limits<std::size_t>::max() / 3) * (three_choices ? 3 : 2);
     }
+    return n;
+}
+
+std::size_t KnittingStateLM21::TransitionIterator::max_transitions() const {
+    return combinations() * (std::size_t)(prev.machine.max_racking - prev.machine.min_racking + 1);
+}
+
+void KnittingStateLM21::TransitionIterator::restrict(std::size_t first, std::size_t count) {
+    remaining = count;
+    if (first >= combinations() || count == 0) {
+        done = true;
+        return;
+    }
+    // xfers is a mixed-radix counter, least significant digit first
+    for (unsigned int i = 0; i < xfers.size(); i++) {
+        std::size_t radix = xfer_types[i] ? 3 : 2;
+        xfers[i] = (char)(first % radix);
+        first /= radix;
+    }
+    apply_xfers();
 }
 
 bool KnittingStateLM21::TransitionIterator::try_next() {
@@ -384,7 +600,11 @@ bool KnittingStateLM21::TransitionIterator::try_next() {
         }
     }
 
-    command = xfer_command + "; rack " + std::to_string(racking);
+    action.racking = racking;
+    if (racking == prev.machine.racking && dominated) {
+        racking++;
+        return false;
+    }
 
     next = next_uncanonical;
     good = next.rack(racking);
@@ -423,26 +643,42 @@ KnittingStateLM21 KnittingStateLM21::TransitionIterator::random(std::mt19937& rn
 }
 
 
+KnittingStateLM21::Undo::Undo() :
+    racking(0),
+    braid(1),
+    offset_counts(),
+    offset_bits(0)
+{ }
+
 KnittingStateLM21::Backpointer::Backpointer() { }
+KnittingStateLM21::Backpointer::Backpointer(const allocator_type& allocator) :
+    prev(allocator)
+{ }
 KnittingStateLM21::Backpointer::Backpointer(
-    const KnittingStateLM21& prev, const std::string& command
+    const KnittingStateLM21& prev, const Action& action
 ) :
     prev(prev),
-    command(command)
+    action(action)
 { }
 
 KnittingStateLM21::Backpointer::Backpointer(
     const KnittingStateLM21::Backpointer& other
 ) :
     prev(other.prev),
-    command(other.command)
+    action(other.action)
+{ }
+KnittingStateLM21::Backpointer::Backpointer(
+    const KnittingStateLM21::Backpointer& other, const allocator_type& allocator
+) :
+    prev(other.prev, allocator),
+    action(other.action)
 { }
 
 KnittingStateLM21::Backpointer& KnittingStateLM21::Backpointer::operator=(
     const KnittingStateLM21::Backpointer& other
 ) {
     prev = other.prev;
-    command = other.command;
+    action = other.action;
     return *this;
 }
 
@@ -2,6 +2,11 @@
 #include "search.h"
 #include "testgen.h"
 #include "prebuilt.h"
+#include "heuristics.h"
+#include "batch.h"
+#include "plan_cache.h"
+#include "windowed.h"
+#include <cstdio>
 #include <iostream>
 #include <random>
 
@@ -56,11 +61,23 @@ int main () {
 
     /* LM21 heuristics */
     {
+        // Suites generate their test cases up front and run every (test
+        // case, configuration) search on a shared pool, printing results in
+        // order. Path lengths and tree sizes match a serial run; seconds are
+        // per search, so they include contention between the threads.
         kn::KnittingMachine flat_machine (7, -5, 5);
         kn::KnittingMachine tube_machine (10, -5, 5);
 
+        using State = kn::KnittingStateLM21;
+
         std::mt19937 rng(1);
 
+        std::vector<kn::TestCase> test_cases;
+        for (int i = 0; i < 200; i++) {
+            test_cases.push_back(i < 100 ? flat_lace(flat_machine, 5, 3, rng) :
+                                           simple_tube(tube_machine, 8, 3, rng));
+        }
+
         kn::ResultAggregate aggregate_1;
         kn::ResultAggregate aggregate_2;
         kn::ResultAggregate aggregate_3;
@@ -68,27 +85,37 @@ int main () {
         kn::ResultAggregate aggregate_5;
         kn::ResultAggregate aggregate_6;
 
+        ThreadPool pool;
+        unsigned int (State::*hs[6])() const = {
+            &State::braid_prebuilt_heuristic, &State::prebuilt_heuristic,
+            &State::braid_log_heuristic, &State::log_heuristic,
+            &State::braid_heuristic, &State::target_heuristic
+        };
+        std::vector<std::future<search::SearchResult<State>>> results[6];
+        for (int j = 0; j < 6; j++) {
+            results[j] = batch::submit<State>(test_cases, [h = hs[j]](const kn::TestCase& test_case) {
+                return test_case.test(true, h);
+            }, pool);
+        }
+
         /* LM21 heuristics */
         for (int i = 0; i < 200; i++) {
-            kn::TestCase test_case = i < 100 ? flat_lace(flat_machine, 5, 3, rng) :
-                                               simple_tube(tube_machine, 8, 3, rng);
-
-            auto result_1 = test_case.test(true, &kn::KnittingStateLM21::braid_prebuilt_heuristic);
+            auto result_1 = results[0][i].get();
             std::cout << result_1.path_length << " " << result_1.seconds_taken << " " << std::flush;
 
-            auto result_2 = test_case.test(true, &kn::KnittingStateLM21::prebuilt_heuristic);
+            auto result_2 = results[1][i].get();
             std::cout << result_2.seconds_taken << " " << std::flush;
 
-            auto result_3 = test_case.test(true, &kn::KnittingStateLM21::braid_log_heuristic);
+            auto result_3 = results[2][i].get();
             std::cout << result_3.seconds_taken << " " << std::flush;
 
-            auto result_4 = test_case.test(true, &kn::KnittingStateLM21::log_heuristic);
+            auto result_4 = results[3][i].get();
             std::cout << result_4.seconds_taken << " " << std::flush;
 
-            auto result_5 = test_case.test(true, &kn::KnittingStateLM21::braid_heuristic);
+            auto result_5 = results[4][i].get();
             std::cout << result_5.seconds_taken << " " << std::flush;
 
-            auto result_6 = test_case.test(true, &kn::KnittingStateLM21::target_heuristic);
+            auto result_6 = results[5][i].get();
             std::cout << result_6.seconds_taken << std::endl;
 
             if (
@@ -99,6 +126,7 @@ int main () {
                 result_1.path_length != result_6.path_length
             ) {
                 std::cout << "error: i = " << i << std::endl;
+                pool.cancel();
                 return 1;
             }
 
@@ -121,6 +149,78 @@ int main () {
 
     return 0;
 
+    /* Member function pointers vs functors */
+    {
+        kn::KnittingMachine flat_machine (7, -5, 5);
+        kn::KnittingMachine tube_machine (10, -5, 5);
+
+        std::mt19937 rng(1);
+
+        using State = kn::KnittingStateLM21;
+        namespace hs = heuristics;
+
+        std::vector<kn::TestCase> test_cases;
+        for (int i = 0; i < 200; i++) {
+            test_cases.push_back(i < 100 ? flat_lace(flat_machine, 5, 3, rng) :
+                                           simple_tube(tube_machine, 8, 3, rng));
+        }
+
+        kn::ResultAggregate pointer_aggregates[6];
+        kn::ResultAggregate functor_aggregates[6];
+
+        ThreadPool pool;
+        auto pointer = [&test_cases, &pool](unsigned int (State::*h)() const) {
+            return batch::submit<State>(test_cases, [h](const kn::TestCase& test_case) {
+                return test_case.test(true, h);
+            }, pool);
+        };
+        auto functor = [&test_cases, &pool](auto h) {
+            return batch::submit<State>(test_cases, [h](const kn::TestCase& test_case) {
+                return test_case.test<State>(true, h);
+            }, pool);
+        };
+        std::vector<std::future<search::SearchResult<State>>> futures[12] = {
+            pointer(&State::braid_prebuilt_heuristic),
+            functor(hs::Member<&State::braid_prebuilt_heuristic>()),
+            pointer(&State::prebuilt_heuristic),
+            functor(hs::Member<&State::prebuilt_heuristic>()),
+            pointer(&State::braid_log_heuristic),
+            functor(hs::Member<&State::braid_log_heuristic>()),
+            pointer(&State::log_heuristic),
+            functor(hs::Member<&State::log_heuristic>()),
+            pointer(&State::braid_heuristic),
+            functor(hs::Member<&State::braid_heuristic>()),
+            pointer(&State::target_heuristic),
+            functor(hs::Member<&State::target_heuristic>())
+        };
+
+        for (int i = 0; i < 200; i++) {
+            std::vector<search::SearchResult<State>> results;
+            for (auto& future : futures) {
+                results.push_back(future[i].get());
+            }
+
+            for (int j = 0; j < 6; j++) {
+                if (results[2*j].path_length != results[2*j + 1].path_length) {
+                    std::cout << "error: i = " << i << std::endl;
+                    pool.cancel();
+                    return 1;
+                }
+
+                pointer_aggregates[j].add_result(results[2*j]);
+                functor_aggregates[j].add_result(results[2*j + 1]);
+            }
+        }
+
+        std::cout << "Nodes/second (pointer functor):\n";
+        for (int j = 0; j < 6; j++) {
+            std::cout << (double)pointer_aggregates[j].search_tree_size / pointer_aggregates[j].seconds_taken
+                      << " "
+                      << (double)functor_aggregates[j].search_tree_size / functor_aggregates[j].seconds_taken
+                      << std::endl;
+        }
+    }
+
     /* LM21 Canonical vs not */
     {
         kn::KnittingMachine flat_machine (9, -5, 5);
@@ -128,21 +228,37 @@ int main () {
 
         std::mt19937 rng(2);
 
+        std::vector<kn::TestCase> test_cases;
+        for (int i = 0; i < 200; i++) {
+            test_cases.push_back(i < 100 ? flat_lace(flat_machine, 6, 3, rng) :
+                                           simple_tube(tube_machine, 10, 3, rng));
+        }
+
         kn::ResultAggregate aggregate_1;
         kn::ResultAggregate aggregate_2;
 
-        for (int i = 0; i < 200; i++) {
-            kn::TestCase test_case = i < 100 ? flat_lace(flat_machine, 6, 3, rng) :
-                                               simple_tube(tube_machine, 10, 3, rng);
+        ThreadPool pool;
+        auto results_1 = batch::submit<kn::KnittingStateLM21>(test_cases,
+            [](const kn::TestCase& test_case) {
+                return test_case.test(true, &kn::KnittingStateLM21::braid_prebuilt_heuristic);
+            }, pool
+        );
+        auto results_2 = batch::submit<kn::KnittingStateLM21>(test_cases,
+            [](const kn::TestCase& test_case) {
+                return test_case.test(false, &kn::KnittingStateLM21::braid_prebuilt_heuristic);
+            }, pool
+        );
 
-            auto result_1 = test_case.test(true, &kn::KnittingStateLM21::braid_prebuilt_heuristic);
+        for (int i = 0; i < 200; i++) {
+            auto result_1 = results_1[i].get();
             std::cout << result_1.path_length << " " << result_1.seconds_taken << " " << std::flush;
 
-            auto result_2 = test_case.test(false, &kn::KnittingStateLM21::braid_prebuilt_heuristic);
+            auto result_2 = results_2[i].get();
             std::cout << result_2.seconds_taken << std::endl;
 
             if (result_1.path_length != result_2.path_length) {
                 std::cout << "error: i = " << i << std::endl;
+                pool.cancel();
                 return 1;
             }
 
@@ -162,21 +278,37 @@ int main () {
 
         std::mt19937 rng(2);
 
+        std::vector<kn::TestCase> test_cases;
+        for (int i = 0; i < 200; i++) {
+            test_cases.push_back(i < 100 ? flat_lace(flat_machine, 6, 3, rng) :
+                                           simple_tube(tube_machine, 10, 3, rng));
+        }
+
         kn::ResultAggregate aggregate_1;
         kn::ResultAggregate aggregate_2;
 
-        for (int i = 0; i < 200; i++) {
-            kn::TestCase test_case = i < 100 ? flat_lace(flat_machine, 6, 3, rng) :
-                                               simple_tube(tube_machine, 10, 3, rng);
+        ThreadPool pool;
+        auto results_1 = batch::submit<kn::KnittingState>(test_cases,
+            [](const kn::TestCase& test_case) {
+                return test_case.test(true, &kn::KnittingState::braid_prebuilt_heuristic);
+            }, pool
+        );
+        auto results_2 = batch::submit<kn::KnittingStateLM21>(test_cases,
+            [](const kn::TestCase& test_case) {
+                return test_case.test(true, &kn::KnittingStateLM21::braid_prebuilt_heuristic);
+            }, pool
+        );
 
-            auto result_1 = test_case.test(true, &kn::KnittingState::braid_prebuilt_heuristic);
+        for (int i = 0; i < 200; i++) {
+            auto result_1 = results_1[i].get();
             std::cout << result_1.path_length << " " << result_1.seconds_taken << " " << std::flush;
 
-            auto result_2 = test_case.test(true, &kn::KnittingStateLM21::braid_prebuilt_heuristic);
+            auto result_2 = results_2[i].get();
             std::cout << result_2.seconds_taken << std::endl;
 
             if (result_1.path_length != result_2.path_length) {
                 std::cout << "error: i = " << i << std::endl;
+                pool.cancel();
                 return 1;
             }
 
@@ -196,22 +328,153 @@ int main () {
 
         std::mt19937 rng(3);
 
+        std::vector<kn::TestCase> test_cases;
+        for (int i = 0; i < 200; i++) {
+            test_cases.push_back(i < 100 ? flat_lace(flat_machine, 8, 3, rng) :
+                                           simple_tube(tube_machine, 14, 4, rng));
+        }
+
+        kn::ResultAggregate aggregate_1;
+        kn::ResultAggregate aggregate_2;
+
+        ThreadPool pool;
+        auto results_1 = batch::submit<kn::KnittingState>(test_cases,
+            [](const kn::TestCase& test_case) {
+                return test_case.test(true, &kn::KnittingState::braid_prebuilt_heuristic);
+            }, pool
+        );
+        auto results_2 = batch::submit<kn::KnittingState>(test_cases,
+            [](const kn::TestCase& test_case) {
+                return test_case.test_id(true, &kn::KnittingState::braid_prebuilt_heuristic);
+            }, pool
+        );
+
+        for (int i = 0; i < 200; i++) {
+            auto result_1 = results_1[i].get();
+            std::cout << result_1.path_length << " " << result_1.seconds_taken << " "
+                      << result_1.search_tree_size << " " << std::flush;
+
+            auto result_2 = results_2[i].get();
+            std::cout << result_2.seconds_taken << " " << result_2.search_tree_size << std::endl;
+
+            if (result_1.path_length != result_2.path_length) {
+                std::cout << "error: i = " << i << std::endl;
+                pool.cancel();
+                return 1;
+            }
+
+            aggregate_1.add_result(result_1);
+            aggregate_2.add_result(result_2);
+        }
+
+        std::cout << "Totals:\n";
+        std::cout << aggregate_1.search_tree_size << " " << aggregate_1.seconds_taken << std::endl;
+        std::cout << aggregate_2.search_tree_size << " " << aggregate_2.seconds_taken << std::endl;
+    }
+
+    /* A* vs depth-first branch and bound */
+    {
+        kn::KnittingMachine flat_machine (10, -5, 5);
+        kn::KnittingMachine tube_machine (16, -5, 5);
+
+        std::mt19937 rng(3);
+
+        std::vector<kn::TestCase> test_cases;
+        for (int i = 0; i < 200; i++) {
+            test_cases.push_back(i < 100 ? flat_lace(flat_machine, 8, 3, rng) :
+                                           simple_tube(tube_machine, 14, 4, rng));
+        }
+
         kn::ResultAggregate aggregate_1;
         kn::ResultAggregate aggregate_2;
 
+        ThreadPool pool;
+        auto results_1 = batch::submit<kn::KnittingState>(test_cases,
+            [](const kn::TestCase& test_case) {
+                return test_case.test(true, &kn::KnittingState::braid_prebuilt_heuristic);
+            }, pool
+        );
+        auto results_2 = batch::submit<kn::KnittingState>(test_cases,
+            [](const kn::TestCase& test_case) {
+                return test_case.solve<kn::KnittingState>(true,
+                    [](const auto& sources, const auto& target, auto adj) {
+                        return search::depth_first_branch_and_bound(
+                            sources, target, adj, &kn::KnittingState::braid_prebuilt_heuristic
+                        );
+                    }
+                );
+            }, pool
+        );
+
+        for (int i = 0; i < 200; i++) {
+            auto result_1 = results_1[i].get();
+            std::cout << result_1.path_length << " " << result_1.seconds_taken << " "
+                      << result_1.search_tree_size << " " << std::flush;
+
+            auto result_2 = results_2[i].get();
+            std::cout << result_2.seconds_taken << " " << result_2.search_tree_size << std::endl;
+
+            if (result_1.path_length != result_2.path_length) {
+                std::cout << "error: i = " << i << std::endl;
+                pool.cancel();
+                return 1;
+            }
+
+            aggregate_1.add_result(result_1);
+            aggregate_2.add_result(result_2);
+        }
+
+        std::cout << "Totals:\n";
+        std::cout << aggregate_1.search_tree_size << " " << aggregate_1.seconds_taken << std::endl;
+        std::cout << aggregate_2.search_tree_size << " " << aggregate_2.seconds_taken << std::endl;
+    }
+
+    /* A* vs partial expansion A* */
+    {
+        kn::KnittingMachine flat_machine (10, -5, 5);
+        kn::KnittingMachine tube_machine (16, -5, 5);
+
+        std::mt19937 rng(3);
+
+        std::vector<kn::TestCase> test_cases;
         for (int i = 0; i < 200; i++) {
-            kn::TestCase test_case = i < 100 ? flat_lace(flat_machine, 8, 3, rng) :
-                                               simple_tube(tube_machine, 14, 4, rng);
+            test_cases.push_back(i < 100 ? flat_lace(flat_machine, 8, 3, rng) :
+                                           simple_tube(tube_machine, 14, 4, rng));
+        }
+
+        kn::ResultAggregate aggregate_1;
+        kn::ResultAggregate aggregate_2;
 
-            auto result_1 = test_case.test(true, &kn::KnittingState::braid_prebuilt_heuristic);
+        ThreadPool pool;
+        auto results_1 = batch::submit<kn::KnittingState>(test_cases,
+            [](const kn::TestCase& test_case) {
+                return test_case.test(true, &kn::KnittingState::braid_prebuilt_heuristic);
+            }, pool
+        );
+        auto results_2 = batch::submit<kn::KnittingState>(test_cases,
+            [](const kn::TestCase& test_case) {
+                return test_case.solve<kn::KnittingState>(true,
+                    [](const auto& sources, const auto& target, auto adj) {
+                        return search::partial_expansion_a_star(
+                            sources, target, adj,
+                            heuristics::Member<&kn::KnittingState::braid_prebuilt_heuristic>()
+                        );
+                    }
+                );
+            }, pool
+        );
+
+        for (int i = 0; i < 200; i++) {
+            auto result_1 = results_1[i].get();
             std::cout << result_1.path_length << " " << result_1.seconds_taken << " "
                       << result_1.search_tree_size << " " << std::flush;
 
-            auto result_2 = test_case.test_id(true, &kn::KnittingState::braid_prebuilt_heuristic);
+            auto result_2 = results_2[i].get();
             std::cout << result_2.seconds_taken << " " << result_2.search_tree_size << std::endl;
 
             if (result_1.path_length != result_2.path_length) {
                 std::cout << "error: i = " << i << std::endl;
+                pool.cancel();
                 return 1;
             }
 
@@ -225,5 +488,202 @@ int main () {
     }
 
 
+    /* Beam search widths */
+    {
+        // plan length vs wall time as the beam widens. The first two
+        // suites are small enough to compare against A*'s optimum.
+        kn::KnittingMachine machines[4] = {
+            kn::KnittingMachine(10, -5, 5), kn::KnittingMachine(16, -5, 5),
+            kn::KnittingMachine(24, -5, 5), kn::KnittingMachine(24, -5, 5)
+        };
+        int loop_counts[4] = { 8, 14, 14, 18 };
+        std::size_t widths[5] = { 1, 4, 16, 64, 256 };
+
+        std::mt19937 rng(4);
+
+        for (int suite = 0; suite < 4; suite++) {
+            std::vector<kn::TestCase> test_cases;
+            for (int i = 0; i < 20; i++) {
+                test_cases.push_back(suite % 2 == 0 ?
+                    flat_lace(machines[suite], loop_counts[suite], 3, rng) :
+                    simple_tube(machines[suite], loop_counts[suite], 4, rng)
+                );
+            }
+
+            std::vector<int> optimal;
+            if (suite < 2) {
+                for (const auto& test_case : test_cases) {
+                    optimal.push_back(test_case.test(
+                        true, &kn::KnittingState::braid_prebuilt_heuristic
+                    ).path_length);
+                }
+            }
+
+            for (std::size_t width : widths) {
+                int total_length = 0;
+                int total_excess = 0;
+                int failures = 0;
+                kn::ResultAggregate aggregate;
+
+                for (std::size_t i = 0; i < test_cases.size(); i++) {
+                    auto result = test_cases[i].solve<kn::KnittingState>(true,
+                        [width](const auto& sources, const auto& target, auto adj) {
+                            return search::beam_search(
+                                sources, target, adj, heuristics::BraidPrebuilt(), width,
+                                [](const auto&) { }
+                            );
+                        }
+                    );
+
+                    if (result.path_length == -1) {
+                        failures++;
+                        continue;
+                    }
+                    total_length += result.path_length;
+                    if (!optimal.empty()) {
+                        total_excess += result.path_length - optimal[i];
+                    }
+                    aggregate.add_result(result);
+                }
+
+                std::cout << suite << " " << width << " " << total_length << " "
+                          << total_excess << " " << failures << " "
+                          << aggregate.seconds_taken << std::endl;
+            }
+        }
+    }
+
+
+    /* Batch planning throughput */
+    {
+        kn::KnittingMachine flat_machine (7, -5, 5);
+        kn::KnittingMachine tube_machine (10, -5, 5);
+
+        std::mt19937 rng(1);
+
+        std::vector<kn::TestCase> test_cases;
+        for (int i = 0; i < 200; i++) {
+            test_cases.push_back(i < 100 ? flat_lace(flat_machine, 5, 3, rng) :
+                                           simple_tube(tube_machine, 8, 3, rng));
+        }
+
+        for (unsigned int threads = 1; threads <= std::thread::hardware_concurrency(); threads *= 2) {
+            auto result = batch::plan<kn::KnittingStateLM21>(test_cases,
+                [](const kn::TestCase& test_case) {
+                    return test_case.test(true, &kn::KnittingStateLM21::braid_prebuilt_heuristic);
+                },
+                threads
+            );
+
+            std::cout << threads << " " << result.problems_per_second() << " "
+                      << result.latency_percentile(0.5) << " "
+                      << result.latency_percentile(0.99) << std::endl;
+        }
+    }
+
+
+    /* Plan cache hit rate */
+    {
+        // a garment repeating 20 local patterns at random positions
+        kn::KnittingMachine pattern_machine (7, -5, 5);
+
+        std::mt19937 rng(5);
+
+        std::vector<kn::TestCase> patterns;
+        for (int i = 0; i < 20; i++) {
+            patterns.push_back(flat_lace(pattern_machine, 5, 3, rng));
+        }
+
+        std::remove("bin/plans.cache");
+        cache::PlanCache plan_cache("bin/plans.cache");
+        auto solve = [](const kn::TestCase& test_case) {
+            return test_case.test(true, &kn::KnittingStateLM21::braid_prebuilt_heuristic);
+        };
+
+        std::uniform_int_distribution<int> pattern_dist(0, 19);
+        std::uniform_int_distribution<int> shift_dist(0, 40);
+        int mismatches = 0;
+        StopWatch stop_watch;
+
+        for (int i = 0; i < 1000; i++) {
+            kn::TestCase test_case = patterns[pattern_dist(rng)].shifted(shift_dist(rng), 50);
+            auto plan = plan_cache.plan(test_case, solve);
+
+            if (i % 50 == 0 && plan.path_length != solve(test_case).path_length) {
+                mismatches++;
+            }
+        }
+
+        std::cout << plan_cache.hits() << " " << plan_cache.misses() << " "
+                  << plan_cache.hit_rate() << " " << plan_cache.mean_lookup_seconds() << " "
+                  << stop_watch.stop() << " " << mismatches << std::endl;
+    }
+
+
+    /* Windowed planning on wide beds */
+    {
+        // panels of 2 to 16 5-needle flat lace patterns between plain
+        // columns, 11 to 95 needles wide (wider than max_search_width, so
+        // only windows of the last are searched); the monolithic search is
+        // only run where it finishes, to report the optimality gap
+        std::vector<int> pattern_counts = { 2, 4, 8, 16 };
+        std::vector<bool> run_monolithic = { true, false, false, false };
+
+        std::mt19937 rng(6);
+
+        for (std::size_t suite = 0; suite < pattern_counts.size(); suite++) {
+            kn::KnittingMachine machine ((char)(6 * pattern_counts[suite] - 1), -3, 3);
+
+            kn::ResultAggregate windowed_aggregate;
+            kn::ResultAggregate monolithic_aggregate;
+            int windowed_length = 0;
+            int monolithic_length = 0;
+            int suboptimal = 0;
+
+            for (int i = 0; i < 10; i++) {
+                kn::TestCase test_case = flat_lace_panel(machine, 5, 3, 3, rng);
+
+                auto plan = windowed::plan<kn::KnittingStateLM21>(
+                    test_case, 0, true, heuristics::BraidLog()
+                );
+                windowed_aggregate.search_tree_size += plan.search_tree_size;
+                windowed_aggregate.seconds_taken += plan.seconds_taken;
+                windowed_length += plan.plan.path_length;
+
+                if (run_monolithic[suite]) {
+                    auto result = test_case.test<kn::KnittingStateLM21>(true, heuristics::BraidLog());
+                    monolithic_aggregate.add_result(result);
+                    monolithic_length += result.path_length;
+                    suboptimal += plan.plan.path_length > result.path_length;
+                }
+            }
+
+            std::cout << (int)machine.width << " "
+                      << windowed_aggregate.search_tree_size << " "
+                      << windowed_aggregate.seconds_taken << " " << windowed_length;
+            if (run_monolithic[suite]) {
+                std::cout << " " << monolithic_aggregate.search_tree_size << " "
+                          << monolithic_aggregate.seconds_taken << " " << monolithic_length
+                          << " " << suboptimal;
+            }
+            std::cout << std::endl;
+        }
+    }
+
+
+    /* Search profile (zeros unless built with make PROFILE=1) */
+    {
+        kn::KnittingMachine tube_machine (10, -5, 5);
+
+        std::mt19937 rng(7);
+
+        for (int i = 0; i < 5; i++) {
+            kn::TestCase test_case = simple_tube(tube_machine, 8, 3, rng);
+            auto result = test_case.test<kn::KnittingStateLM21>(true, heuristics::BraidPrebuilt());
+            std::cout << result.stats.json() << std::endl;
+        }
+    }
+
+
     return 0;
 }
@@ -0,0 +1,263 @@
+#include "knitting.h"
+#include "prebuilt.h"
+#include "testgen.h"
+#include "util.h"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace kn = knitting;
+
+// results are added here so the kernels cannot be optimized away
+std::size_t sink;
+
+class Summary {
+public:
+    double min, median, mean, stddev;
+};
+
+class Options {
+public:
+    int states = 500;
+    int warmup = 5;
+    int samples = 50;
+    unsigned int seed = 1;
+    std::string filter;
+};
+
+// Times `kernel(i)` for every i in [0, n): each sample is one pass over all
+// n, and the summary is of the per-call nanoseconds over the samples.
+// `prepare` runs untimed before each pass, for kernels that modify states.
+template <typename Kernel, typename Prepare>
+Summary measure(std::size_t n, const Options& options, Kernel kernel, Prepare prepare) {
+    if (n == 0) {
+        return Summary();
+    }
+    std::vector<double> ns;
+    for (int s = 0; s < options.warmup + options.samples; s++) {
+        prepare();
+        StopWatch stop_watch;
+        for (std::size_t i = 0; i < n; i++) {
+            kernel(i);
+        }
+        double seconds = stop_watch.stop();
+        if (s >= options.warmup) {
+            ns.push_back(seconds * 1e9 / (double)n);
+        }
+    }
+
+    std::sort(ns.begin(), ns.end());
+    Summary summary;
+    summary.min = ns.front();
+    summary.median = ns[ns.size() / 2];
+    summary.mean = 0;
+    for (double x : ns) summary.mean += x;
+    summary.mean /= (double)ns.size();
+    summary.stddev = 0;
+    for (double x : ns) summary.stddev += (x - summary.mean) * (x - summary.mean);
+    summary.stddev = std::sqrt(summary.stddev / (double)ns.size());
+    return summary;
+}
+
+template <typename Kernel>
+Summary measure(std::size_t n, const Options& options, Kernel kernel) {
+    return measure(n, options, kernel, []() { });
+}
+
+void report(const std::string& name, std::size_t calls, const Summary& summary) {
+    if (calls == 0) {
+        return;
+    }
+    std::cout << name << "," << calls << "," << summary.min << "," << summary.median << ","
+              << summary.mean << "," << summary.stddev << "\n";
+}
+
+// KnittingState's iterator has no random(), so sample the neighbours here
+template <typename State>
+State random_neighbour(const State& state, std::mt19937& rng) {
+    State neighbour = state;
+    int valid_so_far = 0;
+    for (auto it = state.adjacent(); it.has_next(); valid_so_far++) {
+        if (std::uniform_int_distribution<int>(0, valid_so_far)(rng) == 0) {
+            neighbour = it.next;
+        }
+    }
+    return neighbour;
+}
+
+// States as a search meets them: the sources of `options.states` test cases
+// and random walks of up to 8 transitions from them. The targets are kept
+// in `targets`, which must outlive the states.
+template <typename State, typename Generator>
+std::vector<State> sample_states(
+    Generator generate, const Options& options, std::deque<State>& targets
+) {
+    std::mt19937 rng(options.seed);
+    std::vector<State> states;
+    for (int i = 0; i < options.states; i++) {
+        kn::TestCase test_case = generate(rng);
+        targets.push_back(test_case.target_state<State>());
+        State state = test_case.source_state<State>(&targets.back());
+        for (int steps = std::uniform_int_distribution<int>(0, 8)(rng); steps > 0; steps--) {
+            state = random_neighbour(state, rng);
+        }
+        states.push_back(state);
+    }
+    return states;
+}
+
+template <typename State>
+void run_kernels(
+    const std::string& prefix, const kn::KnittingMachine& machine,
+    const std::vector<State>& states, const Options& options
+) {
+    auto selected = [&prefix, &options](const std::string& kernel) {
+        return (prefix + kernel).find(options.filter) != std::string::npos;
+    };
+
+    std::mt19937 rng(options.seed);
+    std::vector<State> work;
+    auto reset = [&work, &states]() { work = states; };
+
+    // a racking other than the current one, and a transfer that succeeds
+    std::vector<char> rackings;
+    std::vector<State> transferable;
+    std::vector<std::pair<char, bool>> transfers;
+    for (const State& state : states) {
+        char racking;
+        do {
+            racking = (char)std::uniform_int_distribution<int>(
+                machine.min_racking, machine.max_racking
+            )(rng);
+        } while (racking == state.racking() && machine.min_racking != machine.max_racking);
+        rackings.push_back(racking);
+
+        bool found = false;
+        for (
+            char i = std::max('\0', state.racking());
+            i < machine.width + std::min('\0', state.racking()) && !found;
+            i++
+        ) {
+            for (bool to_front : { true, false }) {
+                State copy = state;
+                if (!found && state.can_transfer(i) && copy.transfer(i, to_front)) {
+                    transferable.push_back(state);
+                    transfers.emplace_back(i, to_front);
+                    found = true;
+                }
+            }
+        }
+    }
+
+    std::size_t n = states.size();
+    if (selected("copy")) {
+        report(prefix + "copy", n, measure(n, options, [&states](std::size_t i) {
+            State copy = states[i];
+            sink += (std::size_t)copy.racking();
+        }));
+    }
+    if (selected("rack")) {
+        report(prefix + "rack", n, measure(n, options, [&work, &rackings](std::size_t i) {
+            sink += work[i].rack(rackings[i]);
+        }, reset));
+    }
+    if (selected("transfer")) {
+        auto reset_transferable = [&work, &transferable]() { work = transferable; };
+        report(prefix + "transfer", transfers.size(), measure(transfers.size(), options,
+            [&work, &transfers](std::size_t i) {
+                sink += work[i].transfer(transfers[i].first, transfers[i].second);
+            }, reset_transferable
+        ));
+    }
+    if (selected("canonicalize")) {
+        report(prefix + "canonicalize", n, measure(n, options, [&work](std::size_t i) {
+            sink += work[i].canonicalize();
+        }, reset));
+    }
+    if (selected("can_transfer")) {
+        report(prefix + "can_transfer", n, measure(n, options, [&states, &machine](std::size_t i) {
+            char racking = states[i].racking();
+            for (char j = std::max('\0', racking); j < machine.width + std::min('\0', racking); j++) {
+                sink += states[i].can_transfer(j);
+            }
+        }));
+    }
+    if (selected("hash")) {
+        report(prefix + "hash", n, measure(n, options, [&states](std::size_t i) {
+            sink += std::hash<State>()(states[i]);
+        }));
+    }
+    if (selected("==")) {
+        std::vector<State> copies = states;
+        report(prefix + "==", n, measure(n, options, [&states, &copies](std::size_t i) {
+            sink += states[i] == copies[i];
+        }));
+    }
+    if (selected("offsets")) {
+        report(prefix + "offsets", n, measure(n, options, [&states](std::size_t i) {
+            sink += states[i].offsets();
+        }));
+    }
+    if (selected("prebuilt::query")) {
+        report(prefix + "prebuilt::query", n, measure(n, options, [&states](std::size_t i) {
+            sink += prebuilt::query(states[i].offsets(), states[i].racking());
+        }));
+    }
+    if (selected("adjacent")) {
+        report(prefix + "adjacent", n, measure(n, options, [&states](std::size_t i) {
+            for (auto it = states[i].adjacent(); it.has_next(); ) {
+                sink += (std::size_t)it.weight;
+            }
+        }));
+    }
+}
+
+template <typename Generator>
+void run_generator(
+    const std::string& name, const kn::KnittingMachine& machine,
+    Generator generate, const Options& options
+) {
+    std::deque<kn::KnittingState> targets;
+    run_kernels(name + "/knitting/", machine, sample_states(generate, options, targets), options);
+    std::deque<kn::KnittingStateLM21> targets_lm21;
+    run_kernels(name + "/lm21/", machine, sample_states(generate, options, targets_lm21), options);
+}
+
+// bin/microbench [--states N] [--warmup N] [--samples N] [--seed N] [FILTER]
+//
+// Times the state kernels on sampled states (see sample_states), printing
+// one CSV row per generator, state class and kernel with the per-call
+// nanoseconds. can_transfer is per state, over every front needle with a
+// back needle opposite it; adjacent enumerates all transitions of a state.
+// Only kernels whose name contains FILTER are run, e.g. "lm21/rack".
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--states" && i + 1 < argc) options.states = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--warmup" && i + 1 < argc) options.warmup = std::max(0, std::stoi(argv[++i]));
+        else if (arg == "--samples" && i + 1 < argc) options.samples = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--seed" && i + 1 < argc) options.seed = (unsigned int)std::stoul(argv[++i]);
+        else options.filter = arg;
+    }
+
+    prebuilt::construct_table(8, -5, 5);
+
+    std::cout << "kernel,calls,min_ns,median_ns,mean_ns,stddev_ns\n";
+
+    kn::KnittingMachine flat_machine(7, -5, 5);
+    run_generator("flat_lace", flat_machine, [&flat_machine](std::mt19937& rng) {
+        return kn::flat_lace(flat_machine, 5, 3, rng);
+    }, options);
+
+    kn::KnittingMachine tube_machine(10, -5, 5);
+    run_generator("simple_tube", tube_machine, [&tube_machine](std::mt19937& rng) {
+        return kn::simple_tube(tube_machine, 8, 3, rng);
+    }, options);
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "plan.h"
+#include <cctype>
+
+namespace knitting {
+
+Plan::Plan(int path_length, char start_racking, const std::vector<std::string>& commands) :
+    path_length(path_length),
+    start_racking(start_racking),
+    commands(commands)
+{ }
+
+Plan Plan::shifted(int shift) const {
+    std::vector<std::string> shifted_commands;
+
+    for (const std::string& command : commands) {
+        // needle indices appear as "f3" or "b3" in the transfer list
+        std::string shifted_command;
+        for (std::size_t i = 0; i < command.size();) {
+            if (
+                (command[i] == 'f' || command[i] == 'b') &&
+                (i == 0 || command[i-1] == ' ') &&
+                i + 1 < command.size() && std::isdigit(command[i+1])
+            ) {
+                std::size_t j = i + 1;
+                while (j < command.size() && std::isdigit(command[j])) {
+                    j++;
+                }
+                shifted_command += command[i];
+                shifted_command += std::to_string(std::stoi(command.substr(i+1, j-i-1)) + shift);
+                i = j;
+            }
+            else {
+                shifted_command += command[i];
+                i++;
+            }
+        }
+        shifted_commands.push_back(shifted_command);
+    }
+
+    return Plan(path_length, start_racking, shifted_commands);
+}
+
+std::string Plan::serialize() const {
+    std::string s = std::to_string(path_length) + " " + std::to_string(start_racking) + "\n";
+    for (const std::string& command : commands) {
+        s += command + "\n";
+    }
+    return s;
+}
+
+Plan Plan::deserialize(const char* data, std::size_t size) {
+    std::istringstream in(std::string(data, size));
+    int path_length;
+    int start_racking;
+    in >> path_length >> start_racking;
+    in.ignore();
+
+    std::vector<std::string> commands;
+    std::string command;
+    while (std::getline(in, command)) {
+        commands.push_back(command);
+    }
+
+    return Plan(path_length, (char)start_racking, commands);
+}
+
+}
@@ -0,0 +1,84 @@
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "search.h"
+
+#ifndef PLAN_H
+#define PLAN_H
+
+namespace knitting {
+
+// The command sequence of a plan, starting from the racking the path
+// starts at. A path_length of -1 means there is no plan.
+class Plan {
+public:
+    int path_length;
+    char start_racking;
+    std::vector<std::string> commands;
+
+    Plan(int, char, const std::vector<std::string>&);
+
+    template <typename State>
+    Plan(const search::SearchResult<State>& result) :
+        path_length(result.path_length),
+        start_racking(result.path.empty() ? 0 : result.path.front().prev.racking())
+    {
+        for (const auto& backpointer : result.path) {
+            commands.push_back(backpointer.action.command());
+        }
+    }
+
+    // the plan with every needle index increased by shift
+    Plan shifted(int) const;
+
+    // Runs the commands on state, which must be at start_racking,
+    // canonicalizing after each pass if canonicalize is set (as the
+    // canonical transitions do). Returns false if a command is invalid.
+    template <typename State>
+    bool apply(State& state, bool canonicalize) const {
+        for (const std::string& command : commands) {
+            std::istringstream in(command);
+            std::string word;
+            int racking = state.racking();
+
+            while (in >> word) {
+                if (word == "rack") {
+                    in >> racking;
+                }
+                else if ((word[0] == 'f' || word[0] == 'b') && word.size() > 1) {
+                    if (!state.transfer((char)std::stoi(word.substr(1)), word[0] == 'f')) {
+                        return false;
+                    }
+                }
+            }
+
+            if (!state.rack((char)racking)) {
+                return false;
+            }
+            if (canonicalize) {
+                state.canonicalize();
+            }
+        }
+        return true;
+    }
+
+    std::string serialize() const;
+    static Plan deserialize(const char*, std::size_t);
+};
+
+// The knitout transfers and rackings of result's path. Loops moved by
+// canonicalize are not included, so this is only complete for paths found
+// with the non-canonical transitions.
+template <typename State>
+std::string knitout(const search::SearchResult<State>& result) {
+    std::string knitout;
+    for (const auto& backpointer : result.path) {
+        knitout += backpointer.action.knitout(backpointer.prev.racking());
+    }
+    return knitout;
+}
+
+}
+
+#endif
@@ -0,0 +1,166 @@
+#include "plan_cache.h"
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cache {
+
+// Each record is [key size][value size][key][value], with sizes as
+// 32-bit integers.
+
+PlanCache::PlanCache(const std::string& path, int margin) :
+    margin(margin),
+    data(nullptr),
+    size(0),
+    hit_count(0),
+    miss_count(0),
+    coalesced_count(0),
+    lookup_seconds(0)
+{
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        throw PlanCacheIOException();
+    }
+    map_file();
+    index_records(0);
+}
+
+PlanCache::~PlanCache() {
+    if (data != nullptr) {
+        munmap(data, size);
+    }
+    close(fd);
+}
+
+void PlanCache::map_file() {
+    if (data != nullptr) {
+        munmap(data, size);
+        data = nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        throw PlanCacheIOException();
+    }
+    size = (std::size_t)st.st_size;
+
+    if (size > 0) {
+        void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            throw PlanCacheIOException();
+        }
+        data = (char*)p;
+    }
+}
+
+void PlanCache::index_records(std::size_t offset) {
+    while (offset + 8 <= size) {
+        std::uint32_t key_size;
+        std::uint32_t value_size;
+        std::memcpy(&key_size, data + offset, 4);
+        std::memcpy(&value_size, data + offset + 4, 4);
+
+        if (offset + 8 + key_size + value_size > size) {
+            // truncated by an interrupted write
+            break;
+        }
+
+        std::string_view key(data + offset + 8, key_size);
+        index.emplace(std::hash<std::string_view>()(key), offset);
+        offset += 8 + key_size + value_size;
+    }
+}
+
+std::optional<Plan> PlanCache::find(const std::string& key) const {
+    auto [begin, end] = index.equal_range(std::hash<std::string_view>()(key));
+
+    for (auto it = begin; it != end; it++) {
+        std::uint32_t key_size;
+        std::uint32_t value_size;
+        std::memcpy(&key_size, data + it->second, 4);
+        std::memcpy(&value_size, data + it->second + 4, 4);
+
+        if (std::string_view(data + it->second + 8, key_size) == key) {
+            return Plan::deserialize(data + it->second + 8 + key_size, value_size);
+        }
+    }
+
+    return std::nullopt;
+}
+
+void PlanCache::store(const std::string& key, const Plan& plan) {
+    if (find(key)) {
+        return;
+    }
+
+    std::string value = plan.serialize();
+    std::uint32_t key_size = (std::uint32_t)key.size();
+    std::uint32_t value_size = (std::uint32_t)value.size();
+
+    std::string record(8, '\0');
+    std::memcpy(record.data(), &key_size, 4);
+    std::memcpy(record.data() + 4, &value_size, 4);
+    record += key;
+    record += value;
+
+    if (write(fd, record.data(), record.size()) != (ssize_t)record.size()) {
+        throw PlanCacheIOException();
+    }
+
+    std::size_t old_size = size;
+    map_file();
+    index_records(old_size);
+}
+
+std::optional<Plan> PlanCache::lookup(const knitting::TestCase& test_case) {
+    int shift;
+    std::string key = test_case.normalized(margin, shift).key();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    StopWatch stop_watch;
+    auto plan = find(key);
+    lookup_seconds += stop_watch.stop();
+
+    if (!plan) {
+        miss_count++;
+        return std::nullopt;
+    }
+    hit_count++;
+    return plan->shifted(shift);
+}
+
+void PlanCache::insert(const knitting::TestCase& test_case, const Plan& plan) {
+    int shift;
+    std::string key = test_case.normalized(margin, shift).key();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    store(key, plan.shifted(-shift));
+}
+
+std::size_t PlanCache::hits() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hit_count;
+}
+std::size_t PlanCache::misses() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return miss_count;
+}
+std::size_t PlanCache::coalesced() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return coalesced_count;
+}
+double PlanCache::hit_rate() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hit_count + miss_count == 0 ? 0 : (double)hit_count / (double)(hit_count + miss_count);
+}
+double PlanCache::mean_lookup_seconds() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hit_count + miss_count == 0 ? 0 : lookup_seconds / (double)(hit_count + miss_count);
+}
+
+}
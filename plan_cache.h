@@ -0,0 +1,132 @@
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "plan.h"
+#include "testgen.h"
+#include "util.h"
+
+#ifndef PLAN_CACHE_H
+#define PLAN_CACHE_H
+
+namespace cache {
+
+class PlanCacheIOException { };
+
+using knitting::Plan;
+
+// Plans keyed by normalized problems (see TestCase::normalized), so a
+// problem repeated at different positions on the bed is solved once.
+// Problems are solved with at most `margin` empty needles around their
+// loops, or as many as the largest racking if that is more; the plans are
+// always valid, and optimal unless every optimal plan needs more room than
+// that. Searches that find no plan are not cached. Plans are appended to a file that is
+// memory-mapped for lookups and reloaded when the cache is reopened. Safe
+// to use from several threads; concurrent plan calls for the same key wait
+// for a single solve.
+class PlanCache {
+private:
+    int margin;
+    int fd;
+    char* data;
+    std::size_t size;
+
+    // key hash => offset of the record in the file
+    std::unordered_multimap<std::size_t, std::size_t> index;
+    // guards everything here, the counters included
+    mutable std::mutex mutex;
+
+    // keys being solved => their plans once solved
+    std::unordered_map<std::string, std::shared_future<Plan>> pending;
+
+    std::size_t hit_count;
+    std::size_t miss_count;
+    std::size_t coalesced_count;
+    double lookup_seconds;
+
+    void map_file();
+    void index_records(std::size_t);
+    std::optional<Plan> find(const std::string&) const;
+    void store(const std::string&, const Plan&);
+
+public:
+    PlanCache(const std::string&, int = 8);
+    PlanCache(const PlanCache&) = delete;
+    ~PlanCache();
+
+    // the cached plan for test_case, translated to its needles
+    std::optional<Plan> lookup(const knitting::TestCase&);
+    void insert(const knitting::TestCase&, const Plan&);
+
+    // the cached plan for test_case, or the plan of solve(normalized test
+    // case), which is then cached if the search found one; solve returns a
+    // SearchResult
+    template <typename Solve>
+    Plan plan(const knitting::TestCase& test_case, Solve solve) {
+        int shift;
+        knitting::TestCase normalized = test_case.normalized(margin, shift);
+        std::string key = normalized.key();
+
+        std::promise<Plan> promise;
+        std::shared_future<Plan> solving;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            StopWatch stop_watch;
+            auto cached = find(key);
+            lookup_seconds += stop_watch.stop();
+
+            if (cached) {
+                hit_count++;
+                return cached->shifted(shift);
+            }
+
+            auto it = pending.find(key);
+            if (it != pending.end()) {
+                hit_count++;
+                coalesced_count++;
+                solving = it->second;
+            }
+            else {
+                miss_count++;
+                pending.emplace(key, promise.get_future().share());
+            }
+        }
+
+        if (solving.valid()) {
+            return solving.get().shifted(shift);
+        }
+
+        try {
+            auto result = solve(normalized);
+            Plan plan(result);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (result.found()) {
+                store(key, plan);
+            }
+            pending.erase(key);
+            promise.set_value(plan);
+            return plan.shifted(shift);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.erase(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    std::size_t hits() const;
+    std::size_t misses() const;
+    // hits that waited for a concurrent solve of the same problem
+    std::size_t coalesced() const;
+    double hit_rate() const;
+    double mean_lookup_seconds() const;
+};
+
+}
+
+#endif
@@ -0,0 +1,178 @@
+#include "profile.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace profile {
+
+thread_local Totals totals;
+thread_local std::size_t allocations = 0;
+thread_local std::ptrdiff_t live_bytes = 0;
+thread_local std::ptrdiff_t peak_bytes = 0;
+
+const char* timer_name(Timer timer) {
+    switch (timer) {
+        case Rack: return "rack";
+        case Transfer: return "transfer";
+        case Canonicalize: return "canonicalize";
+        case Heuristic: return "heuristic";
+        case Maps: return "maps";
+        case timer_count: break;
+    }
+    return "";
+}
+
+Totals Totals::operator-(const Totals& other) const {
+    Totals difference;
+    for (int i = 0; i < timer_count; i++) {
+        difference.seconds[i] = seconds[i] - other.seconds[i];
+        difference.calls[i] = calls[i] - other.calls[i];
+    }
+    return difference;
+}
+
+Counters& Counters::operator+=(const Counters& other) {
+    available = available && other.available;
+    cycles += other.cycles;
+    instructions += other.instructions;
+    cache_misses += other.cache_misses;
+    branch_misses += other.branch_misses;
+    return *this;
+}
+
+#ifdef __linux__
+
+// one group, led by fds[0], so the four are scheduled together
+CounterGroup::CounterGroup() {
+    fds.fill(-1);
+    const unsigned long long configs[4] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for (std::size_t i = 0; i < fds.size(); i++) {
+        perf_event_attr attr {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.disabled = i == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format =
+            PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+        if (fds[i] == -1) {
+            for (int& fd : fds) {
+                if (fd != -1) close(fd);
+                fd = -1;
+            }
+            return;
+        }
+    }
+
+    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+CounterGroup::~CounterGroup() {
+    for (int fd : fds) {
+        if (fd != -1) close(fd);
+    }
+}
+
+Counters CounterGroup::read() const {
+    Counters counters;
+    // { nr, time_enabled, time_running, values[nr] }
+    std::uint64_t data[3 + 4];
+    if (fds[0] == -1 || ::read(fds[0], data, sizeof(data)) != (ssize_t)sizeof(data) ||
+        data[0] != 4 || data[2] == 0) {
+        return counters;
+    }
+
+    double scale = (double)data[1] / (double)data[2];
+    auto scaled = [scale](std::uint64_t count) {
+        return (std::uint64_t)((double)count * scale);
+    };
+    counters.available = true;
+    counters.cycles = scaled(data[3]);
+    counters.instructions = scaled(data[4]);
+    counters.cache_misses = scaled(data[5]);
+    counters.branch_misses = scaled(data[6]);
+    return counters;
+}
+
+#else
+
+CounterGroup::CounterGroup() {
+    fds.fill(-1);
+}
+
+CounterGroup::~CounterGroup() { }
+
+Counters CounterGroup::read() const {
+    return Counters();
+}
+
+#endif
+
+}
+
+#ifdef KNITTING_PROFILE
+
+static void* counted(void* p) {
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    profile::allocations++;
+#ifdef __GLIBC__
+    profile::live_bytes += (std::ptrdiff_t)malloc_usable_size(p);
+    profile::peak_bytes = std::max(profile::peak_bytes, profile::live_bytes);
+#endif
+    return p;
+}
+
+static void uncounted(void* p) {
+#ifdef __GLIBC__
+    profile::live_bytes -= (std::ptrdiff_t)malloc_usable_size(p);
+#endif
+    std::free(p);
+}
+
+void* operator new(std::size_t size) {
+    return counted(std::malloc(size ? size : 1));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    std::size_t a = (std::size_t)alignment;
+    return counted(std::aligned_alloc(a, (size + a - 1) / a * a));
+}
+
+void operator delete(void* p) noexcept {
+    uncounted(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    uncounted(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    uncounted(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    uncounted(p);
+}
+
+#endif
@@ -0,0 +1,106 @@
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// Time spent in the state operations and in the search's own bookkeeping,
+// collected per thread when built with KNITTING_PROFILE (make PROFILE=1),
+// along with the search counters in SearchStats. Otherwise PROFILE_SCOPE
+// and PROFILE_COUNT expand to nothing, and searches report zeros.
+namespace profile {
+
+enum Timer {
+    Rack,
+    Transfer,
+    Canonicalize,
+    Heuristic,
+    Maps,
+    timer_count
+};
+
+const char* timer_name(Timer);
+
+// Inclusive: canonicalize transfers loops, so its time includes theirs.
+class Totals {
+public:
+    std::array<double, timer_count> seconds {};
+    std::array<std::size_t, timer_count> calls {};
+
+    Totals operator-(const Totals&) const;
+};
+
+// this thread's totals since it started
+extern thread_local Totals totals;
+// heap allocations made by this thread, counted by the replacement
+// operator new in profile.cpp
+extern thread_local std::size_t allocations;
+// Bytes allocated by this thread and not yet freed (which goes negative
+// if it frees memory from other threads), and the most there have been
+// since peak_bytes was last set. Counted only where malloc_usable_size
+// is available (glibc).
+extern thread_local std::ptrdiff_t live_bytes;
+extern thread_local std::ptrdiff_t peak_bytes;
+
+class Scope {
+private:
+    Timer timer;
+    std::chrono::time_point<std::chrono::steady_clock> start_time;
+
+public:
+    Scope(Timer timer) :
+        timer(timer),
+        start_time(std::chrono::steady_clock::now())
+    { }
+    ~Scope() {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+        totals.seconds[timer] += elapsed.count();
+        totals.calls[timer]++;
+    }
+};
+
+// Hardware counts for the calling thread, from perf_event_open. When the
+// counters cannot be opened (not Linux, perf_event_paranoid, no PMU in a
+// VM), available is false and the counts are zero.
+class Counters {
+public:
+    bool available = false;
+    std::uint64_t cycles = 0;
+    std::uint64_t instructions = 0;
+    std::uint64_t cache_misses = 0;
+    std::uint64_t branch_misses = 0;
+
+    // available only if both are
+    Counters& operator+=(const Counters&);
+};
+
+// Starts counting on construction; read() gives the counts since then,
+// scaled up if the kernel had to multiplex the counters.
+class CounterGroup {
+private:
+    std::array<int, 4> fds;
+
+public:
+    CounterGroup();
+    ~CounterGroup();
+    CounterGroup(const CounterGroup&) = delete;
+    CounterGroup& operator=(const CounterGroup&) = delete;
+
+    Counters read() const;
+};
+
+}
+
+#ifdef KNITTING_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(timer) profile::Scope PROFILE_CONCAT(profile_scope_, __LINE__)(profile::timer)
+#define PROFILE_COUNT(counter, n) ((counter) += (n))
+#else
+#define PROFILE_SCOPE(timer)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#endif
+
+#endif
@@ -4,6 +4,18 @@
 #include <deque>
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory_resource>
+#include <optional>
+#include <sstream>
+#include <stop_token>
+#include <type_traits>
+#include "profile.h"
 #include "util.h"
 
 #ifndef SEARCH_H
@@ -14,10 +26,15 @@ namespace search {
 template <typename State>
 class PriorityQueue {
 private:
-    std::deque<std::unordered_set<State>> queue;
+    std::pmr::deque<std::pmr::unordered_set<State>> queue;
 public:
     unsigned int front = 0;
 
+    // the buckets and the states in them are allocated from resource
+    PriorityQueue(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) :
+        queue(resource)
+    { }
+
     void insert(unsigned int key, const State& state) {
         while (key < front) {
             queue.emplace_front();
@@ -36,10 +53,12 @@ public:
         return ret;
     }
 
-    void erase(unsigned int key, const State& state) {
+    // the number of states erased, 0 or 1
+    std::size_t erase(unsigned int key, const State& state) {
         if (0 <= key-front && key-front < queue.size()) {
-            queue[key-front].erase(state);
+            return queue[key-front].erase(state);
         }
+        return 0;
     }
 
     bool empty() {
@@ -50,12 +69,59 @@ public:
 
         return queue.empty();
     }
+
+    // approximate bytes of the queue's copy of state
+    static std::size_t entry_bytes(const State& state) {
+        return sizeof(State) + state.heap_bytes();
+    }
 };
 
+// A PriorityQueue of the states' encodings (see KnittingState::encode),
+// which for tube searches are about a quarter of the size of the states,
+// braids included. States
+// are encoded on insert and erase and decoded on pop, into a copy of the
+// first state inserted. erase finds a state's entry only because equal
+// states have equal encodings.
 template <typename State>
-std::vector<typename State::Backpointer> backpointer_path(
-    const std::unordered_map<State, typename State::Backpointer>& from, State target
-) {
+class CompressedPriorityQueue : private PriorityQueue<std::pmr::string> {
+private:
+    using Base = PriorityQueue<std::pmr::string>;
+    std::optional<State> prototype;
+
+public:
+    using Base::front;
+    using Base::empty;
+
+    CompressedPriorityQueue(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) :
+        Base(resource)
+    { }
+
+    void insert(unsigned int key, const State& state) {
+        if (!prototype) {
+            prototype = state;
+        }
+        Base::insert(key, std::pmr::string(state.encode()));
+    }
+
+    State pop() {
+        State state = *prototype;
+        state.decode(Base::pop());
+        return state;
+    }
+
+    std::size_t erase(unsigned int key, const State& state) {
+        return Base::erase(key, std::pmr::string(state.encode()));
+    }
+
+    static std::size_t entry_bytes(const State& state) {
+        return sizeof(std::pmr::string) + state.encode().size();
+    }
+};
+
+// from maps states to their Backpointer, e.g. a std::unordered_map or its
+// std::pmr equivalent
+template <typename State, typename Map>
+std::vector<typename State::Backpointer> backpointer_path(const Map& from, State target) {
     std::vector<typename State::Backpointer> v;
 
     while (from.count(target)) {
@@ -68,6 +134,197 @@ std::vector<typename State::Backpointer> backpointer_path(
     return v;
 }
 
+// Why a search stopped. Searches other than a_star only report Found or
+// Exhausted (which includes passing their f-value limit).
+enum class SearchStatus {
+    Found,
+    Exhausted,
+    LimitReached,
+    DeadlineExceeded,
+    NodeBudgetExceeded,
+    MemoryBudgetExceeded,
+    Cancelled
+};
+
+inline const char* status_name(SearchStatus status) {
+    switch (status) {
+        case SearchStatus::Found: return "found";
+        case SearchStatus::Exhausted: return "exhausted";
+        case SearchStatus::LimitReached: return "limit reached";
+        case SearchStatus::DeadlineExceeded: return "deadline exceeded";
+        case SearchStatus::NodeBudgetExceeded: return "node budget exceeded";
+        case SearchStatus::MemoryBudgetExceeded: return "memory budget exceeded";
+        case SearchStatus::Cancelled: return "cancelled";
+    }
+    return "";
+}
+
+// Budgets for a_star. The search gives up once the smallest f-value left
+// exceeds limit, seconds_taken exceeds deadline_seconds, it stores more
+// than max_nodes states or about max_bytes bytes of them, or stop is
+// requested on stop_token. The budgets are checked between expansions, so
+// the expansion that crosses max_nodes or max_bytes still completes and
+// can overshoot them by the states it adds.
+//
+// With an expansion_pool, states with more than parallel_transitions
+// possible transitions (max_transitions) are expanded with
+// parallel_successors on it. The pool must not be the one running the
+// search, whose job would then wait on jobs queued behind it.
+class SearchOptions {
+public:
+    unsigned int limit = 1e9;
+    double deadline_seconds = std::numeric_limits<double>::infinity();
+    std::size_t max_nodes = std::numeric_limits<std::size_t>::max();
+    std::size_t max_bytes = std::numeric_limits<std::size_t>::max();
+    std::stop_token stop_token;
+    ThreadPool* expansion_pool = nullptr;
+    std::size_t parallel_transitions = 2000;
+};
+
+// One transition, as a TransitionIterator yields it
+template <typename State>
+class Successor {
+public:
+    using Action = std::remove_cvref_t<decltype(std::declval<typename State::Backpointer>().action)>;
+
+    State next;
+    Action action;
+    int weight;
+};
+
+// The transitions of state, in the order std::invoke(adj, state) yields
+// them, enumerated by splitting its transfer combinations (see
+// TransitionIterator::restrict) into one contiguous range per thread of
+// pool and concatenating the ranges' transitions. combinations is that
+// iterator's combinations(), from the one the caller has already built.
+// Time the state operations spend is profiled on the pool's threads.
+// Every part is waited for before an exception from one is rethrown, as
+// the parts refer to state and adj.
+template <typename State, typename Adj>
+std::vector<Successor<State>> parallel_successors(
+    const State& state, Adj adj, std::size_t combinations, ThreadPool& pool
+) {
+    const std::size_t parts = std::max<std::size_t>(1, std::min<std::size_t>(pool.size(), combinations));
+
+    std::vector<std::future<std::vector<Successor<State>>>> futures;
+    for (std::size_t part = 0; part < parts; part++) {
+        std::size_t first = combinations * part / parts;
+        std::size_t count = combinations * (part + 1) / parts - first;
+        futures.push_back(pool.submit([&state, &adj, first, count]() {
+            std::vector<Successor<State>> successors;
+            auto it = std::invoke(adj, state);
+            it.restrict(first, count);
+            while (it.has_next()) {
+                successors.push_back(Successor<State> { it.next, it.action, it.weight });
+            }
+            return successors;
+        }));
+    }
+
+    std::vector<Successor<State>> successors;
+    std::exception_ptr error;
+    for (auto& future : futures) {
+        try {
+            std::vector<Successor<State>> more = future.get();
+            successors.insert(
+                successors.end(), std::make_move_iterator(more.begin()), std::make_move_iterator(more.end())
+            );
+        }
+        catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return successors;
+}
+
+// Counters and timings for one search, collected by a_star when built
+// with KNITTING_PROFILE (see profile.h); ida_star fills in only the
+// times, hardware counts and heap use. Open states are those in the
+// queue; closed states are stored but not queued.
+class SearchStats {
+public:
+    std::size_t expansions = 0;
+    std::size_t generated = 0;
+    // successors no shorter than their stored distance
+    std::size_t duplicates = 0;
+    // expanded states queued again with a shorter distance
+    std::size_t reopenings = 0;
+    std::size_t queue_inserts = 0;
+    std::size_t queue_erases = 0;
+    std::size_t queue_pops = 0;
+    std::size_t peak_open = 0;
+    std::size_t peak_closed = 0;
+    profile::Totals time;
+    profile::Counters hardware;
+    // heap allocations, including the states' own
+    std::size_t allocations = 0;
+    // the most heap bytes held at once beyond those held at the start
+    // (glibc only)
+    std::size_t peak_bytes = 0;
+
+    std::string json() const {
+        std::ostringstream o;
+        o << "{\"expansions\": " << expansions
+          << ", \"generated\": " << generated
+          << ", \"duplicates\": " << duplicates
+          << ", \"reopenings\": " << reopenings
+          << ", \"queue_inserts\": " << queue_inserts
+          << ", \"queue_erases\": " << queue_erases
+          << ", \"queue_pops\": " << queue_pops
+          << ", \"peak_open\": " << peak_open
+          << ", \"peak_closed\": " << peak_closed
+          << ", \"allocations\": " << allocations
+          << ", \"peak_bytes\": " << peak_bytes;
+        for (int i = 0; i < profile::timer_count; i++) {
+            o << ", \"" << profile::timer_name((profile::Timer)i) << "\": {\"calls\": "
+              << time.calls[i] << ", \"seconds\": " << time.seconds[i] << "}";
+        }
+        o << ", \"hardware\": ";
+        if (hardware.available) {
+            o << "{\"cycles\": " << hardware.cycles
+              << ", \"instructions\": " << hardware.instructions
+              << ", \"cache_misses\": " << hardware.cache_misses
+              << ", \"branch_misses\": " << hardware.branch_misses << "}";
+        }
+        else {
+            o << "null";
+        }
+        o << "}";
+        return o.str();
+    }
+};
+
+// Measures a search from construction: record fills in the time,
+// allocations, peak heap bytes and hardware counts since then.
+class SearchProfile {
+private:
+    profile::Totals start_totals = profile::totals;
+    std::size_t start_allocations = profile::allocations;
+    std::ptrdiff_t start_bytes = profile::live_bytes;
+#ifdef KNITTING_PROFILE
+    profile::CounterGroup counters;
+#endif
+
+public:
+    SearchProfile() {
+        profile::peak_bytes = start_bytes;
+    }
+
+    void record(SearchStats& stats) const {
+        stats.time = profile::totals - start_totals;
+        stats.allocations = profile::allocations - start_allocations;
+        stats.peak_bytes = (std::size_t)(profile::peak_bytes - start_bytes);
+#ifdef KNITTING_PROFILE
+        stats.hardware = counters.read();
+#endif
+    }
+};
+
 template <typename State>
 class SearchResult {
 public:
@@ -76,6 +333,17 @@ public:
     const std::size_t search_tree_size;
     const double seconds_taken;
 
+    const SearchStatus status;
+    // a proven lower bound on the path length: path_length if found, and
+    // the smallest f-value left if the search gave up
+    const unsigned int lower_bound;
+    // for a search that gave up, the expanded state with the smallest
+    // heuristic value (the deepest on ties) and the path to it
+    const std::optional<State> best;
+    const std::vector<typename State::Backpointer> best_path;
+
+    SearchStats stats;
+
     SearchResult(
         const std::vector<typename State::Backpointer>& path,
         unsigned int path_length,
@@ -85,29 +353,263 @@ public:
         path(path),
         path_length(path_length),
         search_tree_size(search_tree_size),
-        seconds_taken(seconds_taken)
+        seconds_taken(seconds_taken),
+        status((int)path_length < 0 ? SearchStatus::Exhausted : SearchStatus::Found),
+        lower_bound((int)path_length < 0 ? std::numeric_limits<unsigned int>::max() : path_length)
     { }
+
+    SearchResult(
+        SearchStatus status,
+        unsigned int lower_bound,
+        const std::optional<State>& best,
+        const std::vector<typename State::Backpointer>& best_path,
+        std::size_t search_tree_size,
+        double seconds_taken
+    ) :
+        path_length(-1),
+        search_tree_size(search_tree_size),
+        seconds_taken(seconds_taken),
+        status(status),
+        lower_bound(lower_bound),
+        best(best),
+        best_path(best_path)
+    { }
+
+    bool found() const {
+        return status == SearchStatus::Found;
+    }
 };
 
-template <typename State, typename TransitionIterator>
+// Approximate bytes a_star keeps per stored state: the queue's entry
+// (queue_bytes, a full copy unless compressed), a copy as the key of each
+// of its three maps, and the backpointer's copy.
+template <typename State>
+std::size_t node_bytes(const State& state, std::size_t queue_bytes) {
+    const std::size_t hash_node = 2*sizeof(void*) + sizeof(std::size_t);
+    return 4*(sizeof(State) + state.heap_bytes()) + queue_bytes + 2*sizeof(unsigned int)
+         + sizeof(typename State::Backpointer) - sizeof(State) + 4*hash_node;
+}
+
+template <typename State>
+std::size_t node_bytes(const State& state) {
+    return node_bytes(state, PriorityQueue<State>::entry_bytes(state));
+}
+
+// a_star with its open states held in a Queue, PriorityQueue<State> or
+// CompressedPriorityQueue<State>
+template <typename Queue, typename State, typename Adj, typename H>
+SearchResult<State> a_star_with_queue(
+    const std::vector<State>& sources, const State& target,
+    Adj adj, H h,
+    const SearchOptions& options
+) {
+    StopWatch stop_watch;
+    SearchStats stats;
+    SearchProfile search_profile;
+
+    // the tables, and the states stored in them, are pooled for this search
+    // and released together when it returns; results hold plain copies
+    std::pmr::unsynchronized_pool_resource arena;
+    Queue q(&arena);
+    std::pmr::unordered_map<State, unsigned int> d(&arena);
+    std::pmr::unordered_map<State, unsigned int> dh(&arena);
+    std::pmr::unordered_map<State, typename State::Backpointer> from(&arena);
+
+    auto heuristic = [&h](const State& state) {
+        PROFILE_SCOPE(Heuristic);
+        return std::invoke(h, state);
+    };
+
+    for (const State& source : sources) {
+        unsigned int source_h = heuristic(source);
+        PROFILE_SCOPE(Maps);
+        q.insert(source_h, source);
+        d[source] = 0;
+        dh[source] = source_h;
+        PROFILE_COUNT(stats.queue_inserts, 1);
+    }
+
+    std::size_t max_nodes = options.max_nodes;
+    if (options.max_bytes != std::numeric_limits<std::size_t>::max() && !sources.empty()) {
+        max_nodes = std::min(max_nodes, options.max_bytes / node_bytes(
+            sources.front(), Queue::entry_bytes(sources.front())
+        ));
+    }
+    std::optional<State> best;
+    unsigned int best_d = 0;
+    unsigned int best_h = 0;
+
+    auto dist_at = [&d](const State& state) {
+        PROFILE_SCOPE(Maps);
+        auto it = d.find(state);
+        return it != d.end() ? it->second : 1'000'000'000;
+    };
+
+    auto finish = [&](SearchResult<State> result) {
+        result.stats = stats;
+        search_profile.record(result.stats);
+        return result;
+    };
+    auto give_up = [&](SearchStatus status) {
+        return finish(SearchResult<State>(
+            status, q.front, best,
+            best ? backpointer_path(from, *best) : std::vector<typename State::Backpointer>(),
+            d.size(), stop_watch.stop()
+        ));
+    };
+
+    for (std::size_t expanded = 0; !q.empty(); expanded++) {
+        if (q.front > options.limit) {
+            return give_up(SearchStatus::LimitReached);
+        }
+        if (d.size() > max_nodes) {
+            return give_up(
+                max_nodes < options.max_nodes ?
+                SearchStatus::MemoryBudgetExceeded : SearchStatus::NodeBudgetExceeded
+            );
+        }
+        if (options.stop_token.stop_requested()) {
+            return give_up(SearchStatus::Cancelled);
+        }
+        // deadlines are in seconds and 64 expansions take about a
+        // millisecond, so the clock need not be read on every expansion
+        if (expanded % 64 == 0 && stop_watch.stop() > options.deadline_seconds) {
+            return give_up(SearchStatus::DeadlineExceeded);
+        }
+
+#ifdef KNITTING_PROFILE
+        std::size_t open = stats.queue_inserts - stats.queue_erases - stats.queue_pops;
+        stats.peak_open = std::max(stats.peak_open, open);
+        stats.peak_closed = std::max(stats.peak_closed, d.size() - open);
+#endif
+
+        State state = q.pop();
+        unsigned int state_d = dist_at(state);
+        PROFILE_COUNT(stats.queue_pops, 1);
+
+        if (state == target) {
+            return finish(SearchResult<State>(
+                backpointer_path(from, target), state_d, d.size(), stop_watch.stop()
+            ));
+        }
+        PROFILE_COUNT(stats.expansions, 1);
+
+        unsigned int state_h = dh[state] - state_d;
+        if (!best || state_h < best_h || (state_h == best_h && state_d > best_d)) {
+            best = state;
+            best_d = state_d;
+            best_h = state_h;
+        }
+
+        auto relax = [&](const State& next, const auto& action, int weight) {
+            const unsigned int cand_d = state_d + weight;
+            PROFILE_COUNT(stats.generated, 1);
+
+            if (cand_d < dist_at(next)) {
+                unsigned int cand_dh = cand_d + heuristic(next);
+                PROFILE_SCOPE(Maps);
+                // assigned in place, to reuse the arena's copy of the state
+                auto& back = from[next];
+                back.prev = state;
+                back.action = action;
+                d[next] = cand_d;
+
+                auto old_dh = dh.find(next);
+                if (old_dh != dh.end()) {
+                    [[maybe_unused]] std::size_t erased = q.erase(old_dh->second, next);
+                    PROFILE_COUNT(stats.queue_erases, erased);
+                    PROFILE_COUNT(stats.reopenings, 1 - erased);
+                    old_dh->second = cand_dh;
+                }
+                else {
+                    dh.emplace(next, cand_dh);
+                }
+                q.insert(cand_dh, next);
+                PROFILE_COUNT(stats.queue_inserts, 1);
+            }
+            else {
+                PROFILE_COUNT(stats.duplicates, 1);
+            }
+        };
+
+        auto it = std::invoke(adj, state);
+        if (options.expansion_pool && it.max_transitions() > options.parallel_transitions) {
+            auto successors = parallel_successors(state, adj, it.combinations(), *options.expansion_pool);
+            for (const auto& successor : successors) {
+                relax(successor.next, successor.action, successor.weight);
+            }
+        }
+        else {
+            while (it.has_next()) {
+                relax(it.next, it.action, it.weight);
+            }
+        }
+    }
+
+    return finish(SearchResult<State>(
+        std::vector<typename State::Backpointer>(), -1, d.size(), stop_watch.stop()
+    ));
+}
+
+// `adj` and `h` may be member function pointers (e.g.
+// `&State::canonical_adjacent`) or function objects such as the ones in
+// heuristics.h. Function objects are called directly, so the compiler can
+// inline and specialize them.
+template <typename State, typename Adj, typename H>
+SearchResult<State> a_star(
+    const std::vector<State>& sources, const State& target,
+    Adj adj, H h,
+    const SearchOptions& options
+) {
+    return a_star_with_queue<PriorityQueue<State>>(sources, target, adj, h, options);
+}
+
+template <typename State, typename Adj, typename H>
 SearchResult<State> a_star(
     const std::vector<State>& sources, const State& target,
-    TransitionIterator (State::*adj)() const, unsigned int (State::*h)() const,
+    Adj adj, H h,
+    unsigned int limit = 1e9
+) {
+    SearchOptions options;
+    options.limit = limit;
+    return a_star(sources, target, adj, h, options);
+}
+
+// a_star keeping its open states encoded (see CompressedPriorityQueue),
+// trading the encoding on every insert and decoding on every pop for a
+// smaller open list. The plans are as short as a_star's, but states with
+// equal f-values are popped in a different order.
+template <typename State, typename Adj, typename H>
+SearchResult<State> compressed_a_star(
+    const std::vector<State>& sources, const State& target,
+    Adj adj, H h,
+    const SearchOptions& options = SearchOptions()
+) {
+    return a_star_with_queue<CompressedPriorityQueue<State>>(sources, target, adj, h, options);
+}
+
+// Partial expansion A*. Expanding a node only stores the successors whose
+// f-value is at most the node's stored f-value; the node is then re-queued
+// with the smallest f-value among the successors it skipped. Successors
+// with large f-values are thus generated but never stored unless needed.
+template <typename State, typename Adj, typename H>
+SearchResult<State> partial_expansion_a_star(
+    const std::vector<State>& sources, const State& target,
+    Adj adj, H h,
     unsigned int limit = 1e9
 ) {
     StopWatch stop_watch;
     PriorityQueue<State> q;
     std::unordered_map<State, unsigned int> d;
-    std::unordered_map<State, unsigned int> dh;
+    std::unordered_map<State, unsigned int> f;
     std::unordered_map<State, typename State::Backpointer> from;
 
     for (const State& source : sources) {
-        q.insert((source.*h)(), source);
+        q.insert(std::invoke(h, source), source);
         d[source] = 0;
-        dh[source] = (source.*h)();
+        f[source] = std::invoke(h, source);
     }
 
-
     auto dist_at = [&d](const State& state) {
         return d.count(state) ? d[state] : 1'000'000'000;
     };
@@ -115,6 +617,7 @@ SearchResult<State> a_star(
     while (!q.empty() && q.front <= limit) {
         State state = q.pop();
         unsigned int state_d = dist_at(state);
+        unsigned int state_f = f[state];
 
         if (state == target) {
             return SearchResult<State>(
@@ -122,21 +625,35 @@ SearchResult<State> a_star(
             );
         }
 
-        TransitionIterator it = (state.*adj)();
+        unsigned int next_f = std::numeric_limits<unsigned int>::max();
+
+        auto it = std::invoke(adj, state);
         while (it.has_next()) {
             const unsigned int cand_d = state_d + it.weight;
 
             if (cand_d < dist_at(it.next)) {
-                from[it.next] = typename State::Backpointer(state, it.command);
+                const unsigned int cand_f = cand_d + std::invoke(h, it.next);
+
+                if (cand_f > state_f) {
+                    next_f = std::min(next_f, cand_f);
+                    continue;
+                }
+
+                from[it.next] = typename State::Backpointer(state, it.action);
                 d[it.next] = cand_d;
 
-                if (dh.count(it.next)) {
-                    q.erase(dh[it.next], it.next);
+                if (f.count(it.next)) {
+                    q.erase(f[it.next], it.next);
                 }
-                dh[it.next] = cand_d + (it.next.*h)();
-                q.insert(dh[it.next], it.next);
+                f[it.next] = cand_f;
+                q.insert(cand_f, it.next);
             }
         }
+
+        if (next_f != std::numeric_limits<unsigned int>::max()) {
+            f[state] = next_f;
+            q.insert(next_f, state);
+        }
     }
 
     return SearchResult<State>(
@@ -144,94 +661,751 @@ SearchResult<State> a_star(
     );
 }
 
-template <typename State, typename TransitionIterator>
-SearchResult<State> ida_star_search(
-    const State& source, const State& target,
-    TransitionIterator (State::*adj)() const, unsigned int (State::*h)() const,
-    unsigned int bound
+// Anytime repairing A* (ARA*). Runs weighted A* with f = g + w*h for a
+// decreasing sequence of weights w, reusing the distances found by the
+// previous iterations. Whenever the plan or its proven suboptimality
+// bound improves, on_solution(result, bound) is called. Stops once the
+// bound reaches 1 or after `seconds` seconds, returning the best plan.
+// Weights are rounded to multiples of 0.01.
+template <typename State, typename Adj, typename H, typename OnSolution>
+SearchResult<State> anytime_a_star(
+    const std::vector<State>& sources, const State& target,
+    Adj adj, H h, OnSolution on_solution,
+    double seconds = std::numeric_limits<double>::infinity(),
+    double initial_weight = 3, double weight_step = 0.5
 ) {
+    constexpr unsigned int scale = 100;
+    constexpr unsigned int infinity = 1'000'000'000;
+
     StopWatch stop_watch;
-    std::size_t nodes_searched = 0;
+    PriorityQueue<State> q;
+    std::unordered_map<State, unsigned int> d;
+    std::unordered_map<State, unsigned int> hs;
+    std::unordered_map<State, unsigned int> open;
+    std::unordered_set<State> closed;
+    std::unordered_set<State> incons;
+    std::unordered_map<State, typename State::Backpointer> from;
 
-    std::vector<TransitionIterator> path;
-    path.reserve(bound+2);
-    path.push_back((source.*adj)());
-    std::vector<unsigned int> ds { 0 };
-    std::vector<unsigned int> dhs { (source.*h)() };
+    unsigned int weight = (unsigned int)std::lround(std::max(initial_weight, 1.0) * scale);
+    const unsigned int step = std::max(1u, (unsigned int)std::lround(weight_step * scale));
 
-    while (!path.empty()) {
-        auto& it = path.back();
+    auto dist_at = [&d](const State& state) {
+        return d.count(state) ? d[state] : infinity;
+    };
+    auto key = [&](const State& state) {
+        return scale*d[state] + weight*hs[state];
+    };
+    auto push = [&](const State& state) {
+        if (open.count(state)) {
+            q.erase(open[state], state);
+        }
+        open[state] = key(state);
+        q.insert(open[state], state);
+    };
 
-        if (it.has_next()) {
-            nodes_searched++;
+    for (const State& source : sources) {
+        d[source] = 0;
+        hs[source] = std::invoke(h, source);
+        push(source);
+    }
+
+    // expands states until the target is at least as good as every open
+    // state; returns false if time ran out first
+    auto improve_path = [&]() {
+        while (!q.empty() && (dist_at(target) == infinity || scale*dist_at(target) > q.front)) {
+            if (stop_watch.stop() > seconds) {
+                return false;
+            }
+
+            State state = q.pop();
+            open.erase(state);
+            closed.insert(state);
+            unsigned int state_d = d[state];
 
-            unsigned int d = ds.back() + it.weight;
-            unsigned int dh = d + (it.next.*h)();
+            auto it = std::invoke(adj, state);
+            while (it.has_next()) {
+                const unsigned int cand_d = state_d + it.weight;
 
-            if (it.next == target && dh <= bound) {
-                std::vector<typename State::Backpointer> back_path;
+                if (cand_d < dist_at(it.next)) {
+                    from[it.next] = typename State::Backpointer(state, it.action);
+                    d[it.next] = cand_d;
+                    if (!hs.count(it.next)) {
+                        hs[it.next] = std::invoke(h, it.next);
+                    }
 
-                for (auto& back_it : path) {
-                    back_path.emplace_back(back_it.prev, back_it.command);
+                    if (closed.count(it.next)) {
+                        incons.insert(it.next);
+                    }
+                    else {
+                        push(it.next);
+                    }
                 }
+            }
+        }
+        return true;
+    };
 
-                return SearchResult<State>(
-                    back_path, d, nodes_searched, stop_watch.stop()
+    // a lower bound on the optimal plan length is the smallest g + h
+    // among the states that may still lead to a better plan
+    auto bound = [&]() {
+        unsigned int lower = dist_at(target);
+        for (const auto& [state, _] : open) {
+            lower = std::min(lower, d[state] + hs[state]);
+        }
+        for (const State& state : incons) {
+            lower = std::min(lower, d[state] + hs[state]);
+        }
+        if (lower == 0) {
+            return (double)weight / scale;
+        }
+        return std::min((double)weight / scale, (double)dist_at(target) / lower);
+    };
+
+    unsigned int best_d = infinity;
+    double best_bound = std::numeric_limits<double>::infinity();
+
+    while (true) {
+        bool finished = improve_path();
+
+        if (dist_at(target) < infinity) {
+            double b = bound();
+            if (dist_at(target) < best_d || b < best_bound) {
+                best_d = dist_at(target);
+                best_bound = std::min(b, best_bound);
+                on_solution(
+                    SearchResult<State>(
+                        backpointer_path(from, target), best_d, d.size(), stop_watch.stop()
+                    ),
+                    best_bound
                 );
             }
+        }
 
-            if (dh <= bound) {
-                auto next_it = (it.next.*adj)();
-                path.push_back(next_it);
-                ds.push_back(d);
-                dhs.push_back(dh);
+        if (!finished || best_bound <= 1 || weight == scale) {
+            break;
+        }
+
+        weight = std::max(scale, weight - std::min(weight, step));
+
+        for (const State& state : incons) {
+            open[state] = 0;
+        }
+        incons.clear();
+        closed.clear();
+        q = PriorityQueue<State>();
+        for (auto& [state, state_key] : open) {
+            state_key = key(state);
+            q.insert(state_key, state);
+        }
+    }
+
+    if (best_d == infinity) {
+        return SearchResult<State>(
+            std::vector<typename State::Backpointer>(), -1, d.size(), stop_watch.stop()
+        );
+    }
+    return SearchResult<State>(
+        backpointer_path(from, target), best_d, d.size(), stop_watch.stop()
+    );
+}
+
+// Beam search. Each layer keeps the `width` successors of the previous
+// layer with the smallest g + h, skipping states already kept by this or an
+// earlier layer. on_solution is called with every plan that is better than
+// the previous one, and the best plan is returned. Uses O(width * depth)
+// memory, but the plans found are not optimal in general.
+template <typename State, typename Adj, typename H, typename OnSolution>
+SearchResult<State> beam_search(
+    const std::vector<State>& sources, const State& target,
+    Adj adj, H h, std::size_t width, OnSolution on_solution,
+    unsigned int limit = 1e9
+) {
+    struct Candidate {
+        unsigned int d;
+        unsigned int dh;
+        typename State::Backpointer from;
+    };
+
+    StopWatch stop_watch;
+    std::unordered_map<State, unsigned int> d;
+    std::unordered_map<State, typename State::Backpointer> from;
+    std::vector<State> layer;
+    std::size_t nodes_searched = 0;
+
+    unsigned int best_d = 1'000'000'000;
+
+    auto dist_at = [&d](const State& state) {
+        return d.count(state) ? d[state] : 1'000'000'000;
+    };
+
+    for (const State& source : sources) {
+        nodes_searched++;
+        d[source] = 0;
+        if (source == target) {
+            return SearchResult<State>(
+                std::vector<typename State::Backpointer>(), 0, nodes_searched, stop_watch.stop()
+            );
+        }
+        layer.push_back(source);
+    }
+
+    for (unsigned int depth = 0; !layer.empty() && depth < limit; depth++) {
+        std::unordered_map<State, Candidate> candidates;
+
+        for (const State& state : layer) {
+            const unsigned int state_d = d[state];
+
+            auto it = std::invoke(adj, state);
+            while (it.has_next()) {
+                nodes_searched++;
+                const unsigned int cand_d = state_d + it.weight;
+
+                if (cand_d >= dist_at(it.next) || cand_d >= best_d) {
+                    continue;
+                }
+
+                if (it.next == target) {
+                    best_d = cand_d;
+                    d[target] = cand_d;
+                    from[target] = typename State::Backpointer(state, it.action);
+                    on_solution(SearchResult<State>(
+                        backpointer_path(from, target), best_d, nodes_searched, stop_watch.stop()
+                    ));
+                    continue;
+                }
+
+                auto cand = candidates.find(it.next);
+                if (cand == candidates.end() || cand_d < cand->second.d) {
+                    const unsigned int cand_dh = cand_d + std::invoke(h, it.next);
+                    if (cand_dh < best_d) {
+                        candidates.insert_or_assign(it.next, Candidate {
+                            cand_d, cand_dh, typename State::Backpointer(state, it.action)
+                        });
+                    }
+                }
             }
         }
-        else {
-            path.pop_back();
-            ds.pop_back();
-            dhs.pop_back();
+
+        std::vector<std::pair<unsigned int, const State*>> order;
+        order.reserve(candidates.size());
+        for (const auto& [state, cand] : candidates) {
+            order.emplace_back(cand.dh, &state);
+        }
+        if (order.size() > width) {
+            std::nth_element(
+                order.begin(), order.begin() + (long)width, order.end(),
+                [](const auto& a, const auto& b) { return a.first < b.first; }
+            );
+            order.resize(width);
+        }
+
+        layer.clear();
+        for (const auto& [_, state] : order) {
+            const Candidate& cand = candidates.at(*state);
+            d[*state] = cand.d;
+            from[*state] = cand.from;
+            layer.push_back(*state);
         }
     }
 
+    if (!d.count(target)) {
+        return SearchResult<State>(
+            std::vector<typename State::Backpointer>(), -1, nodes_searched, stop_watch.stop()
+        );
+    }
     return SearchResult<State>(
-        std::vector<typename State::Backpointer>(), -1, nodes_searched, stop_watch.stop()
+        backpointer_path(from, target), best_d, nodes_searched, stop_watch.stop()
     );
 }
 
-template <typename State, typename TransitionIterator>
+// One depth of ida_star_search: the successors within the bound of the
+// state there, in order of f-value, the next one to descend into, and
+// what descending into it changed.
+template <typename State>
+class IdaStarLevel {
+public:
+    using Action = std::remove_cvref_t<decltype(std::declval<typename State::Backpointer>().action)>;
+
+    struct Child {
+        unsigned int f;
+        unsigned int d;
+        Action action;
+    };
+
+    std::vector<Child> children;
+    std::size_t next = 0;
+    typename State::Undo undo;
+};
+
+// One iteration of ida_star from state, which it changes in place with
+// make and unmake, and restores before returning. Each state's successors
+// are generated by one iterator reset on it, and are descended into
+// lowest f-value first, so the target is met early in the last iteration.
+// levels keeps its storage between iterations, so once it has grown a
+// descent allocates nothing outside the state operations.
+template <typename State, typename Adj, typename H>
+SearchResult<State> ida_star_search(
+    State& state, const State& target,
+    Adj adj, H h,
+    unsigned int bound,
+    std::vector<IdaStarLevel<State>>& levels
+) {
+    using Child = typename IdaStarLevel<State>::Child;
+
+    StopWatch stop_watch;
+    std::size_t nodes_searched = 0;
+
+    auto it = std::invoke(adj, state);
+    std::optional<Child> found;
+    // fills levels[depth] with the successors of state, at distance d
+    auto expand = [&](std::size_t depth, unsigned int d) {
+        if (levels.size() <= depth) {
+            levels.emplace_back();
+        }
+        IdaStarLevel<State>& level = levels[depth];
+        level.children.clear();
+        level.next = 0;
+
+        while (it.has_next()) {
+            nodes_searched++;
+
+            unsigned int next_d = d + it.weight;
+            unsigned int f = next_d + std::invoke(h, it.next);
+            if (f > bound) {
+                continue;
+            }
+            if (it.next == target) {
+                found = Child { f, next_d, it.action };
+                return;
+            }
+            level.children.push_back(Child { f, next_d, it.action });
+        }
+        std::stable_sort(level.children.begin(), level.children.end(), [](const Child& a, const Child& b) {
+            return a.f < b.f;
+        });
+    };
+
+    std::size_t depth = 0;
+    expand(0, 0);
+    while (!found) {
+        IdaStarLevel<State>& level = levels[depth];
+        if (level.next == level.children.size()) {
+            if (depth == 0) {
+                return SearchResult<State>(
+                    std::vector<typename State::Backpointer>(), -1, nodes_searched, stop_watch.stop()
+                );
+            }
+            depth--;
+            state.unmake(levels[depth].undo);
+            continue;
+        }
+
+        const Child& child = level.children[level.next++];
+        unsigned int d = child.d;
+        state.make(child.action, it.canonicalizes(), level.undo);
+        depth++;
+        it.reset();
+        expand(depth, d);
+    }
+
+    // the path's states, unmade back to the source
+    std::vector<typename State::Backpointer> path;
+    path.emplace_back(state, found->action);
+    while (depth > 0) {
+        depth--;
+        state.unmake(levels[depth].undo);
+        path.emplace_back(state, levels[depth].children[levels[depth].next - 1].action);
+    }
+    std::reverse(path.begin(), path.end());
+
+    return SearchResult<State>(path, found->d, nodes_searched, stop_watch.stop());
+}
+
+template <typename State, typename Adj, typename H>
 SearchResult<State> ida_star(
     const std::vector<State>& sources, const State& target,
-    TransitionIterator (State::*adj)() const, unsigned int (State::*h)() const,
+    Adj adj, H h,
     unsigned int limit = 1e9
 ) {
     StopWatch stop_watch;
     std::size_t nodes_searched = 0;
 
+    SearchProfile search_profile;
+    auto finish = [&search_profile](SearchResult<State> result) {
+        search_profile.record(result.stats);
+        return result;
+    };
+
     // edge case for when target is equal to one of the sources
     for (const State& source : sources) {
         nodes_searched++;
         if (source == target) {
-            return SearchResult<State>(
+            return finish(SearchResult<State>(
                 std::vector<typename State::Backpointer>(), 0, nodes_searched, stop_watch.stop()
-            );
+            ));
         }
     }
 
+    // searched in place, and left as they were by each iteration
+    std::vector<State> states = sources;
+    std::vector<IdaStarLevel<State>> levels;
     for (unsigned int bound = 1; bound < limit; bound++) {
-        for (const State& source : sources) {
-            auto result = ida_star_search(source, target, adj, h, bound);
+        for (State& state : states) {
+            auto result = ida_star_search(state, target, adj, h, bound, levels);
             nodes_searched += result.search_tree_size;
             if (result.path_length != -1) {
-                return SearchResult<State>(
+                return finish(SearchResult<State>(
                     result.path, result.path_length, nodes_searched, stop_watch.stop()
-                );
+                ));
             }
         }
     }
-    return SearchResult<State>(
+    return finish(SearchResult<State>(
         std::vector<typename State::Backpointer>(), -1, nodes_searched, stop_watch.stop()
-    );
+    ));
+}
+
+// Depth-first branch and bound. Explores depth first, each state's
+// successors in order of f-value, pruning those whose f-value is no less
+// than the bound and those already on the current path; each plan found
+// lowers the bound to its length, so the last is optimal for admissible
+// heuristics. The bound starts at the length of a greedy plan
+// (beam_search of width 1). Where the greedy descent fails, the search
+// instead runs with bounds doubling from the sources' smallest f-value,
+// until one finds a plan, rather than going unbounded into the depths.
+// Memory is the current path and its states' successors, and unlike
+// ida_star there are at most a few iterations. search_tree_size counts
+// the states generated, by the greedy descent included.
+template <typename State, typename Adj, typename H>
+SearchResult<State> depth_first_branch_and_bound(
+    const std::vector<State>& sources, const State& target,
+    Adj adj, H h,
+    unsigned int limit = 1e9
+) {
+    using Backpointer = typename State::Backpointer;
+    using Action = std::remove_cvref_t<decltype(std::declval<Backpointer>().action)>;
+
+    struct Child {
+        unsigned int f;
+        unsigned int d;
+        State state;
+        Action action;
+    };
+    struct Frame {
+        State state;
+        Action action;
+        std::vector<Child> children;
+        std::size_t next = 0;
+    };
+
+    StopWatch stop_watch;
+    std::size_t nodes_searched = 0;
+
+    SearchProfile search_profile;
+    auto finish = [&search_profile](SearchResult<State> result) {
+        search_profile.record(result.stats);
+        return result;
+    };
+
+    // plans must be shorter than bound, which is best_path's length once
+    // one is found
+    unsigned int bound = limit + 1;
+    std::optional<std::vector<Backpointer>> best_path;
+    auto greedy = beam_search(sources, target, adj, h, 1, [](const auto&) { }, limit);
+    nodes_searched += greedy.search_tree_size;
+    if (greedy.path_length == 0) {
+        return finish(SearchResult<State>(greedy.path, 0, nodes_searched, stop_watch.stop()));
+    }
+    if (greedy.path_length > 0) {
+        bound = (unsigned int)greedy.path_length;
+        best_path = greedy.path;
+    }
+
+    // the smallest f-value pruned by the last pass
+    unsigned int next_bound = std::numeric_limits<unsigned int>::max();
+    auto sorted_children = [&](const State& state, unsigned int d) {
+        std::vector<Child> children;
+        auto it = std::invoke(adj, state);
+        while (it.has_next()) {
+            nodes_searched++;
+            unsigned int next_d = d + it.weight;
+            unsigned int f = next_d + std::invoke(h, it.next);
+            if (f < bound) {
+                children.push_back(Child { f, next_d, it.next, it.action });
+            }
+            else {
+                next_bound = std::min(next_bound, f);
+            }
+        }
+        std::stable_sort(children.begin(), children.end(), [](const Child& a, const Child& b) {
+            return a.f < b.f;
+        });
+        return children;
+    };
+
+    auto branch_and_bound = [&]() {
+        next_bound = std::numeric_limits<unsigned int>::max();
+        std::vector<Frame> path;
+        for (const State& source : sources) {
+            if (std::invoke(h, source) >= bound) {
+                next_bound = std::min(next_bound, (unsigned int)std::invoke(h, source));
+                continue;
+            }
+            path.push_back(Frame { source, Action(), sorted_children(source, 0) });
+
+            while (!path.empty()) {
+                Frame& frame = path.back();
+                if (frame.next == frame.children.size()) {
+                    path.pop_back();
+                    continue;
+                }
+                const Child& child = frame.children[frame.next++];
+                if (child.f >= bound) {
+                    // and so are the rest
+                    frame.next = frame.children.size();
+                    continue;
+                }
+
+                if (child.state == target) {
+                    bound = child.d;
+                    best_path.emplace();
+                    for (std::size_t i = 1; i < path.size(); i++) {
+                        best_path->emplace_back(path[i - 1].state, path[i].action);
+                    }
+                    best_path->emplace_back(frame.state, child.action);
+                    continue;
+                }
+
+                bool on_path = false;
+                for (std::size_t i = 0; i < path.size() && !on_path; i++) {
+                    on_path = path[i].state == child.state;
+                }
+                if (!on_path) {
+                    // built before growing path, which moves frame and child
+                    Frame next { child.state, child.action, sorted_children(child.state, child.d) };
+                    path.push_back(std::move(next));
+                }
+            }
+        }
+    };
+
+    if (best_path) {
+        branch_and_bound();
+    }
+    else {
+        bound = std::numeric_limits<unsigned int>::max();
+        for (const State& source : sources) {
+            bound = std::min(bound, (unsigned int)std::invoke(h, source));
+        }
+        while (!best_path && bound <= limit) {
+            bound = std::min(std::max(2 * bound, bound + 1), limit + 1);
+            branch_and_bound();
+            if (!best_path) {
+                bound = next_bound == std::numeric_limits<unsigned int>::max() ? limit + 1 : next_bound;
+            }
+        }
+    }
+
+    if (!best_path) {
+        return finish(SearchResult<State>(
+            std::vector<Backpointer>(), -1, nodes_searched, stop_watch.stop()
+        ));
+    }
+    return finish(SearchResult<State>(*best_path, bound, nodes_searched, stop_watch.stop()));
+}
+
+// One search of breadth_first_heuristic_search's. found is set if the goal
+// was reached, at depth d; relay is then the state the path to it was
+// split at (see layered_search), if any.
+template <typename State>
+class LayeredSearch {
+public:
+    bool found = false;
+    unsigned int d = 0;
+    std::optional<State> relay;
+    unsigned int relay_d = 0;
+    // the smallest f-value pruned
+    unsigned int next_bound = std::numeric_limits<unsigned int>::max();
+    std::size_t expansions = 0;
+};
+
+// Expands the states reachable from sources in layers of equal depth d,
+// shallowest first, until goal is expanded. Successors deeper than max_d
+// or with d0 + d + h above bound are pruned. Only the last keep_layers
+// expanded layers and those not yet expanded are kept, so a state whose
+// layer was dropped may be reached and expanded again deeper. Each state
+// past the middle depth, max_d / 2, points to the relay where its path
+// crossed the middle: the last state before it, or the first after it if
+// the path crossed from a source. Relays are interior states of the path.
+template <typename State, typename Adj, typename H>
+LayeredSearch<State> layered_search(
+    const std::vector<State>& sources, const State& goal,
+    Adj adj, H h,
+    unsigned int d0, unsigned int max_d, unsigned int bound, unsigned int keep_layers
+) {
+    using Relays = std::unordered_map<State, unsigned int>;
+    using Layer = std::unordered_map<State, const typename Relays::value_type*>;
+
+    LayeredSearch<State> result;
+    const unsigned int middle = max_d / 2;
+    Relays relays;
+    std::map<unsigned int, Layer> layers;
+
+    for (const State& source : sources) {
+        unsigned int f = d0 + std::invoke(h, source);
+        if (f <= bound) {
+            layers[0].emplace(source, nullptr);
+        }
+        else {
+            result.next_bound = std::min(result.next_bound, f);
+        }
+    }
+
+    for (auto current = layers.begin(); current != layers.end(); current++) {
+        const unsigned int d = current->first;
+
+        for (const auto& [state, relay] : current->second) {
+            if (state == goal) {
+                result.found = true;
+                result.d = d;
+                if (relay) {
+                    result.relay = relay->first;
+                    result.relay_d = relay->second;
+                }
+                return result;
+            }
+            result.expansions++;
+
+            auto it = std::invoke(adj, state);
+            while (it.has_next()) {
+                const unsigned int next_d = d + it.weight;
+                const unsigned int f = d0 + next_d + std::invoke(h, it.next);
+                // before the depth check: at the top level max_d is the
+                // bound, so successors too deep also raise the next one
+                if (f > bound) {
+                    result.next_bound = std::min(result.next_bound, f);
+                    continue;
+                }
+                if (next_d > max_d) {
+                    continue;
+                }
+
+                // kept at no greater depth, or moved up from a deeper layer
+                auto deeper = layers.upper_bound(next_d);
+                bool kept = false;
+                for (auto layer = layers.begin(); layer != deeper && !kept; layer++) {
+                    kept = layer->second.count(it.next);
+                }
+                if (kept) {
+                    continue;
+                }
+                for (; deeper != layers.end(); deeper++) {
+                    deeper->second.erase(it.next);
+                }
+
+                auto next_relay = relay;
+                if (!relay && d <= middle && next_d > middle) {
+                    if (d > 0) {
+                        next_relay = &*relays.emplace(state, d).first;
+                    }
+                    else if (!(it.next == goal)) {
+                        next_relay = &*relays.emplace(it.next, next_d).first;
+                    }
+                }
+                layers[next_d].emplace(it.next, next_relay);
+            }
+        }
+
+        while (!layers.empty() && layers.begin()->first + keep_layers <= d) {
+            layers.erase(layers.begin());
+        }
+    }
+
+    return result;
+}
+
+// The path to goal found by search, of length search.d and starting at
+// one of sources: recursively the paths to and from its relay, down to
+// paths of one transition.
+template <typename State, typename Adj, typename H>
+std::vector<typename State::Backpointer> relay_path(
+    const std::vector<State>& sources, const State& goal,
+    Adj adj, H h,
+    unsigned int d0, unsigned int bound, unsigned int keep_layers,
+    const LayeredSearch<State>& search, std::size_t& expansions
+) {
+    using Backpointer = typename State::Backpointer;
+
+    if (!search.relay) {
+        for (const State& source : sources) {
+            if (search.d == 0 && source == goal) {
+                return std::vector<Backpointer>();
+            }
+            auto it = std::invoke(adj, source);
+            while (it.has_next()) {
+                if (it.next == goal && (unsigned int)it.weight == search.d) {
+                    return std::vector<Backpointer> { Backpointer(source, it.action) };
+                }
+            }
+        }
+        return std::vector<Backpointer>();
+    }
+
+    const std::vector<State> relay { *search.relay };
+    auto half = [&](const std::vector<State>& from, const State& to, unsigned int from_d0, unsigned int d) {
+        auto half_search = layered_search(from, to, adj, h, from_d0, d, bound, keep_layers);
+        expansions += half_search.expansions;
+        return relay_path(from, to, adj, h, from_d0, bound, keep_layers, half_search, expansions);
+    };
+
+    std::vector<Backpointer> path = half(sources, relay[0], d0, search.relay_d);
+    std::vector<Backpointer> rest = half(relay, goal, d0 + search.relay_d, search.d - search.relay_d);
+    path.insert(path.end(), rest.begin(), rest.end());
+    return path;
+}
+
+// Breadth-first heuristic search. Rather than storing every state reached,
+// as a_star does, each iteration runs a layered_search bounded by f, from
+// the smallest heuristic value of the sources up to the smallest f-value
+// pruned by the last iteration, keeping only keep_layers layers (at least
+// 1) beyond those still to be expanded. The first iteration to reach the
+// target has an optimal bound, which holds every state of an optimal path
+// for admissible heuristics. The path is then rebuilt by searching again
+// to and from the relay state near its middle, recursively, with the same
+// bound. search_tree_size counts expansions over all the searches.
+template <typename State, typename Adj, typename H>
+SearchResult<State> breadth_first_heuristic_search(
+    const std::vector<State>& sources, const State& target,
+    Adj adj, H h,
+    unsigned int keep_layers = 2, unsigned int limit = 1e9
+) {
+    StopWatch stop_watch;
+    std::size_t expansions = 0;
+    keep_layers = std::max(keep_layers, 1u);
+
+    SearchProfile search_profile;
+    auto finish = [&search_profile](SearchResult<State> result) {
+        search_profile.record(result.stats);
+        return result;
+    };
+
+    unsigned int bound = std::numeric_limits<unsigned int>::max();
+    for (const State& source : sources) {
+        bound = std::min(bound, (unsigned int)std::invoke(h, source));
+    }
+
+    while (bound <= limit) {
+        auto search = layered_search(sources, target, adj, h, 0, bound, bound, keep_layers);
+        expansions += search.expansions;
+        if (search.found) {
+            auto path = relay_path(sources, target, adj, h, 0, bound, keep_layers, search, expansions);
+            return finish(SearchResult<State>(path, search.d, expansions, stop_watch.stop()));
+        }
+        bound = search.next_bound;
+    }
+    return finish(SearchResult<State>(
+        std::vector<typename State::Backpointer>(), -1, expansions, stop_watch.stop()
+    ));
 }
 
 }
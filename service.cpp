@@ -0,0 +1,135 @@
+#include "service.h"
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace service {
+
+sockaddr_un socket_address(const std::string& path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw SocketException();
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+int listen(const std::string& path) {
+    sockaddr_un address = socket_address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw SocketException();
+    }
+
+    // a socket file left by a previous daemon
+    unlink(path.c_str());
+    if (
+        bind(fd, (sockaddr*)&address, sizeof(address)) < 0 ||
+        ::listen(fd, SOMAXCONN) < 0
+    ) {
+        close(fd);
+        throw SocketException();
+    }
+    return fd;
+}
+
+int connect(const std::string& path) {
+    sockaddr_un address = socket_address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw SocketException();
+    }
+    if (::connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        throw SocketException();
+    }
+    return fd;
+}
+
+void write_all(int fd, const std::string& s) {
+    for (std::size_t written = 0; written < s.size();) {
+        ssize_t n = write(fd, s.data() + written, s.size() - written);
+        if (n < 0) {
+            throw SocketException();
+        }
+        written += (std::size_t)n;
+    }
+}
+
+LineReader::LineReader(int fd) :
+    fd(fd),
+    start(0)
+{ }
+
+bool LineReader::read_line(std::string& line) {
+    while (true) {
+        std::size_t end = buffer.find('\n', start);
+        if (end != std::string::npos) {
+            line.assign(buffer, start, end - start);
+            start = end + 1;
+            return true;
+        }
+
+        buffer.erase(0, start);
+        start = 0;
+        char chunk[4096];
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, (std::size_t)n);
+    }
+}
+
+std::string request(const std::string& id, const knitting::TestCase& test_case) {
+    std::string s = id;
+    s += " ";
+    s += test_case.key();
+    s += "\n";
+    return s;
+}
+
+std::string response(const std::string& id, const knitting::Plan& plan) {
+    std::string s = id;
+    s += " ";
+    s += std::to_string(plan.commands.size() + 1);
+    s += "\n";
+    s += plan.serialize();
+    return s;
+}
+
+std::string error_response(const std::string& id) {
+    return id + " error\n";
+}
+
+bool read_response(LineReader& in, std::string& id, std::optional<knitting::Plan>& plan) {
+    std::string line;
+    if (!in.read_line(line)) {
+        return false;
+    }
+
+    std::istringstream header(line);
+    std::string count;
+    header >> id >> count;
+    if (count == "error") {
+        plan.reset();
+        return true;
+    }
+
+    std::string serialized;
+    for (int i = 0; i < std::stoi(count); i++) {
+        if (!in.read_line(line)) {
+            return false;
+        }
+        serialized += line;
+        serialized += "\n";
+    }
+    plan.emplace(knitting::Plan::deserialize(serialized.data(), serialized.size()));
+    return true;
+}
+
+}
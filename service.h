@@ -0,0 +1,51 @@
+#include <optional>
+#include <string>
+#include "plan.h"
+#include "testgen.h"
+
+#ifndef SERVICE_H
+#define SERVICE_H
+
+// The line protocol between bin/daemon and bin/client over a UNIX domain
+// socket. A request is "<id> <key>", where key is TestCase::key() and id
+// is any token without spaces. Each request is answered, in the order the
+// plans are found, by "<id> <n>" followed by the n lines of
+// Plan::serialize(), or by "<id> error" if the key is invalid or the
+// search gives up. Plans are for the canonical LM21 transitions, so they
+// are applied with canonicalize set. The request "stats" is answered by
+// "stats <hits> <misses> <coalesced>" for the daemon's plan cache.
+namespace service {
+
+class SocketException { };
+
+// a UNIX domain socket listening at / connected to path
+int listen(const std::string& path);
+int connect(const std::string& path);
+
+// writes all of s to fd
+void write_all(int fd, const std::string& s);
+
+class LineReader {
+private:
+    int fd;
+    std::string buffer;
+    std::size_t start;
+
+public:
+    LineReader(int);
+
+    // the next line without its newline; false at the end of the stream
+    bool read_line(std::string&);
+};
+
+std::string request(const std::string& id, const knitting::TestCase&);
+std::string response(const std::string& id, const knitting::Plan&);
+std::string error_response(const std::string& id);
+
+// Reads the next response; plan is empty for an error. Returns false at
+// the end of the stream.
+bool read_response(LineReader&, std::string& id, std::optional<knitting::Plan>& plan);
+
+}
+
+#endif
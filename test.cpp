@@ -1,11 +1,26 @@
+#include "batch.h"
+#include "external.h"
 #include "knitting.h"
 #include "search.h"
 #include "prebuilt.h"
+#include "plan_cache.h"
+#include "testgen.h"
+#include "windowed.h"
+#include <atomic>
+#include <cstdio>
 #include <iostream>
+#include <unordered_map>
 
 namespace cb = CBraid;
 using namespace knitting;
 
+// whether plan takes test_case's source to its target
+static bool plan_is_valid(const TestCase& test_case, const Plan& plan) {
+    KnittingStateLM21 target = test_case.target_state<KnittingStateLM21>();
+    KnittingStateLM21 state = test_case.source_state<KnittingStateLM21>(&target);
+    return state.rack(plan.start_racking) && plan.apply(state, true) && state == target;
+}
+
 int main () {
     int test_needle_order_count = 0;
     auto test_needle_order =
@@ -85,6 +100,21 @@ int main () {
         ).path_length;
         if (opt != 2) std::cout << "error: opt = " << opt << "\n";
 
+        int opt_pea = search::partial_expansion_a_star(
+            source.all_rackings(), target,
+            &KnittingState::adjacent, &KnittingState::braid_heuristic
+        ).path_length;
+        if (opt_pea != opt) std::cout << "error: opt_pea = " << opt_pea << "\n";
+
+        double last_bound = 0;
+        int opt_anytime = search::anytime_a_star(
+            source.all_rackings(), target,
+            &KnittingState::adjacent, &KnittingState::braid_heuristic,
+            [&last_bound](const auto&, double bound) { last_bound = bound; }
+        ).path_length;
+        if (opt_anytime != opt) std::cout << "error: opt_anytime = " << opt_anytime << "\n";
+        if (last_bound != 1) std::cout << "error: last_bound = " << last_bound << "\n";
+
         source.transfer(3, false);
         int opt_back = search::a_star(
             source.all_rackings(), target,
@@ -100,5 +130,468 @@ int main () {
         if (opt_front != 6) std::cout << "error: opt_front = " << opt_front << "\n";
     }
 
+    // searches that give up report a lower bound and their best state
+    {
+        std::mt19937 rng(4);
+        TestCase test_case = simple_tube(KnittingMachine(10, -5, 5), 8, 3, rng);
+        int opt = test_case.test<KnittingStateLM21>(true, heuristics::Log()).path_length;
+
+        auto search_with = [&test_case](const search::SearchOptions& options) {
+            return test_case.solve<KnittingStateLM21>(true,
+                [&options](const auto& sources, const auto& target, auto adj) {
+                    return search::a_star(sources, target, adj, heuristics::Log(), options);
+                }
+            );
+        };
+
+        search::SearchOptions options;
+        options.max_nodes = 20;
+        auto capped = search_with(options);
+        if (
+            capped.status != search::SearchStatus::NodeBudgetExceeded ||
+            capped.lower_bound > (unsigned int)opt || !capped.best
+        ) {
+            std::cout << "error: a_star node budget (" << search::status_name(capped.status) << ")\n";
+        }
+
+        std::stop_source stop;
+        stop.request_stop();
+        options.max_nodes = std::numeric_limits<std::size_t>::max();
+        options.stop_token = stop.get_token();
+        if (search_with(options).status != search::SearchStatus::Cancelled) {
+            std::cout << "error: a_star cancellation\n";
+        }
+    }
+
+    // expanding states in parallel enumerates the same transitions in the
+    // same order, so a_star searches the same tree
+    {
+        std::mt19937 rng(6);
+        ThreadPool pool(3);
+        for (int i = 0; i < 3; i++) {
+            TestCase test_case = simple_tube(KnittingMachine(10, -5, 5), 8, 3, rng);
+            auto search_with = [&test_case](const search::SearchOptions& options) {
+                return test_case.solve<KnittingStateLM21>(true,
+                    [&options](const auto& sources, const auto& target, auto adj) {
+                        return search::a_star(sources, target, adj, heuristics::Log(), options);
+                    }
+                );
+            };
+            auto serial = search_with(search::SearchOptions());
+            search::SearchOptions options;
+            options.expansion_pool = &pool;
+            options.parallel_transitions = 0;
+            auto parallel = search_with(options);
+            if (
+                parallel.path_length != serial.path_length ||
+                parallel.search_tree_size != serial.search_tree_size
+            ) {
+                std::cout << "error: parallel expansion " << i << "\n";
+            }
+        }
+    }
+
+    // actions format as the commands Plan::apply reads
+    {
+        Action action(1ull << 3, 1ull << 5, 2);
+        if (action.command() != "xfer f3 b5; rack 2") {
+            std::cout << "error: Action::command = " << action.command() << "\n";
+        }
+        if (action.knitout(1) != "xfer b2 f3\nxfer f5 b4\nrack 2\n") {
+            std::cout << "error: Action::knitout\n";
+        }
+        if (Action(0, 0, -1).command() != "xfer none; rack -1") {
+            std::cout << "error: Action::command (no transfers)\n";
+        }
+    }
+
+    // plans and problem keys are invariant under translation
+    {
+        Plan plan(3, -1, { "xfer f3 b12; rack -2", "xfer none; rack 0" });
+        auto shifted = plan.shifted(5).commands;
+        if (shifted[0] != "xfer f8 b17; rack -2" || shifted[1] != "xfer none; rack 0") {
+            std::cout << "error: Plan::shifted\n";
+        }
+
+        std::mt19937 rng(1);
+        TestCase test_case = flat_lace(KnittingMachine(7, -3, 3), 4, 2, rng);
+        int shift_1, shift_2;
+        if (test_case.normalized(127, shift_1).key() != test_case.key() || shift_1 != 0) {
+            std::cout << "error: TestCase::normalized (exact)\n";
+        }
+        // away from the bed's edges, the racking's worth of needles is kept
+        std::string key_1 = test_case.shifted(4, 20).normalized(0, shift_1).key();
+        std::string key_2 = test_case.shifted(9, 20).normalized(0, shift_2).key();
+        if (key_1 != key_2 || shift_2 != shift_1 + 5) {
+            std::cout << "error: TestCase::normalized (margin 0)\n";
+        }
+
+        // plans for the narrowed bed replay, canonicalized, on the original
+        TestCase wide = test_case.shifted(9, 20);
+        TestCase narrow = wide.normalized(0, shift_2);
+        Plan narrow_plan(narrow.test<KnittingStateLM21>(true, heuristics::Log()));
+        if (!plan_is_valid(wide, narrow_plan.shifted(shift_2))) {
+            std::cout << "error: TestCase::normalized plan is invalid\n";
+        }
+
+        // searches that give up are not cached, so the next request solves
+        // again, while found plans are
+        std::remove("test_plan_cache.bin");
+        {
+            cache::PlanCache plan_cache("test_plan_cache.bin");
+            auto solve_with = [](std::size_t max_nodes) {
+                return [max_nodes](const TestCase& normalized) {
+                    search::SearchOptions options;
+                    options.max_nodes = max_nodes;
+                    return normalized.solve<KnittingStateLM21>(true,
+                        [&options](const auto& sources, const auto& target, auto adj) {
+                            return search::a_star(sources, target, adj, heuristics::Log(), options);
+                        }
+                    );
+                };
+            };
+            plan_cache.plan(test_case, solve_with(1));
+            Plan plan = plan_cache.plan(test_case, solve_with(std::numeric_limits<std::size_t>::max()));
+            plan_cache.plan(test_case, solve_with(1));
+            if (plan.path_length < 0 || plan_cache.misses() != 2 || plan_cache.hits() != 1) {
+                std::cout << "error: PlanCache::plan cached a search that gave up\n";
+            }
+        }
+        std::remove("test_plan_cache.bin");
+
+        // keys are the daemon's request format
+        TestCase tube = simple_tube(KnittingMachine(10, -5, 5), 8, 3, rng);
+        if (TestCase::parse(tube.key()).key() != tube.key()) {
+            std::cout << "error: TestCase::parse\n";
+        }
+    }
+
+    // windowed plans reach the target and are never shorter than optimal
+    {
+        std::mt19937 rng(2);
+        for (int i = 0; i < 5; i++) {
+            TestCase test_case = flat_lace_panel(KnittingMachine(9, -1, 1), 4, 3, 2, rng);
+            auto windowed_plan = windowed::plan<KnittingStateLM21>(
+                test_case, 0, true, heuristics::Log()
+            ).plan;
+            if (!plan_is_valid(test_case, windowed_plan)) {
+                std::cout << "error: windowed plan " << i << " is invalid\n";
+            }
+
+            int opt = test_case.test<KnittingStateLM21>(true, heuristics::Log()).path_length;
+            if (windowed_plan.path_length < opt) {
+                std::cout << "error: windowed plan " << i << " is shorter than optimal\n";
+            }
+        }
+
+        // beds wider than a search can enumerate are planned in windows
+        TestCase wide = flat_lace_panel(KnittingMachine(95, -3, 3), 5, 3, 3, rng);
+        auto wide_plan = windowed::plan<KnittingStateLM21>(wide, 0, true, heuristics::Log()).plan;
+        if (!plan_is_valid(wide, wide_plan)) {
+            std::cout << "error: windowed plan on a 95 needle bed is invalid\n";
+        }
+    }
+
+    // states survive encoding, and compressed and external A* find
+    // optimal, valid plans (run_records is small so the bucket sorts are
+    // merged from runs)
+    {
+        std::mt19937 rng(3);
+        for (int i = 0; i < 3; i++) {
+            TestCase test_case = flat_lace(KnittingMachine(7, -3, 3), 4, 2, rng);
+            KnittingStateLM21 target = test_case.target_state<KnittingStateLM21>();
+            KnittingStateLM21 source = test_case.source_state<KnittingStateLM21>(&target);
+            KnittingStateLM21 decoded = target;
+            decoded.decode(source.encode());
+            KnittingState knitting_target = test_case.target_state<KnittingState>();
+            KnittingState knitting_source = test_case.source_state<KnittingState>(&knitting_target);
+            KnittingState knitting_decoded = knitting_target;
+            knitting_decoded.decode(knitting_source.encode());
+            if (!(decoded == source) || !(knitting_decoded == knitting_source)) {
+                std::cout << "error: encode " << i << " does not round trip\n";
+            }
+            // equal states reached along different transitions encode alike
+            std::unordered_map<KnittingState, std::string> encodings;
+            bool encodings_agree = true;
+            for (auto it = knitting_source.canonical_adjacent(); it.has_next(); ) {
+                for (auto next_it = it.next.canonical_adjacent(); next_it.has_next(); ) {
+                    auto [seen, fresh] = encodings.emplace(next_it.next, next_it.next.encode());
+                    encodings_agree = encodings_agree && (fresh || seen->second == next_it.next.encode());
+                }
+            }
+            if (!encodings_agree) {
+                std::cout << "error: equal states " << i << " encode differently\n";
+            }
+
+            external::Options options;
+            options.run_records = 16;
+            auto result = test_case.solve<KnittingStateLM21>(true,
+                [&options](const auto& sources, const auto& target, auto adj) {
+                    return external::a_star(sources, target, adj, heuristics::Log(), options);
+                }
+            );
+            int opt = test_case.test<KnittingStateLM21>(true, heuristics::Log()).path_length;
+            if (result.path_length != opt) {
+                std::cout << "error: external a_star " << i << " = " << result.path_length << "\n";
+            }
+            int compressed = test_case.solve<KnittingStateLM21>(true,
+                [](const auto& sources, const auto& target, auto adj) {
+                    return search::compressed_a_star(sources, target, adj, heuristics::Log());
+                }
+            ).path_length;
+            if (compressed != opt) {
+                std::cout << "error: compressed a_star " << i << " = " << compressed << "\n";
+            }
+            int knitting_opt = test_case.test<KnittingState>(true, heuristics::Log()).path_length;
+            int knitting_compressed = test_case.solve<KnittingState>(true,
+                [](const auto& sources, const auto& target, auto adj) {
+                    return search::compressed_a_star(sources, target, adj, heuristics::Log());
+                }
+            ).path_length;
+            if (knitting_compressed != knitting_opt) {
+                std::cout << "error: compressed a_star " << i << " for KnittingState = "
+                          << knitting_compressed << "\n";
+            }
+
+            if (!plan_is_valid(test_case, Plan(result))) {
+                std::cout << "error: external a_star plan " << i << " is invalid\n";
+            }
+        }
+    }
+
+    // breadth-first heuristic search rebuilds optimal, valid plans from
+    // its relays, keeping one layer or several
+    {
+        std::mt19937 rng(5);
+        for (int i = 0; i < 4; i++) {
+            TestCase test_case = simple_tube(KnittingMachine(8, -3, 3), 6, 2, rng);
+            int opt = test_case.test<KnittingStateLM21>(true, heuristics::Log()).path_length;
+
+            for (unsigned int keep_layers : { 1u, 3u }) {
+                auto result = test_case.solve<KnittingStateLM21>(true,
+                    [keep_layers](const auto& sources, const auto& target, auto adj) {
+                        return search::breadth_first_heuristic_search(
+                            sources, target, adj, heuristics::Log(), keep_layers
+                        );
+                    }
+                );
+                if (result.path_length != opt) {
+                    std::cout << "error: breadth_first_heuristic_search " << i << " = "
+                              << result.path_length << "\n";
+                }
+                if (!plan_is_valid(test_case, Plan(result))) {
+                    std::cout << "error: breadth_first_heuristic_search plan " << i << " is invalid\n";
+                }
+            }
+
+            // without a heuristic every bound is first exceeded by depth
+            auto uninformed = test_case.solve<KnittingStateLM21>(true,
+                [](const auto& sources, const auto& target, auto adj) {
+                    return search::breadth_first_heuristic_search(
+                        sources, target, adj, heuristics::None()
+                    );
+                }
+            );
+            if (uninformed.path_length != opt) {
+                std::cout << "error: uninformed breadth_first_heuristic_search " << i << " = "
+                          << uninformed.path_length << "\n";
+            }
+            if (!plan_is_valid(test_case, Plan(uninformed))) {
+                std::cout << "error: uninformed breadth_first_heuristic_search plan " << i << " is invalid\n";
+            }
+        }
+    }
+
+    // depth-first branch and bound improves its greedy plans to optimal,
+    // valid ones
+    {
+        std::mt19937 rng(5);
+        for (int i = 0; i < 4; i++) {
+            TestCase test_case = simple_tube(KnittingMachine(8, -3, 3), 6, 2, rng);
+            int opt = test_case.test<KnittingStateLM21>(true, heuristics::Log()).path_length;
+            auto result = test_case.solve<KnittingStateLM21>(true,
+                [](const auto& sources, const auto& target, auto adj) {
+                    return search::depth_first_branch_and_bound(
+                        sources, target, adj, heuristics::Log()
+                    );
+                }
+            );
+            if (result.path_length != opt) {
+                std::cout << "error: depth_first_branch_and_bound " << i << " = "
+                          << result.path_length << "\n";
+            }
+            if (!plan_is_valid(test_case, Plan(result))) {
+                std::cout << "error: depth_first_branch_and_bound plan " << i << " is invalid\n";
+            }
+        }
+    }
+
+    // pruning dominated transfer combinations keeps plans optimal, for
+    // both kinds of state
+    {
+        std::mt19937 rng(7);
+        KnittingMachine machine(7, -3, 3);
+        auto search = [](const auto& sources, const auto& target, auto adj) {
+            return search::a_star(sources, target, adj, heuristics::Log());
+        };
+        for (int i = 0; i < 4; i++) {
+            TestCase test_case = flat_lace(machine, 5, 3, rng);
+            int pruned = test_case.solve<KnittingStateLM21>(true, search).path_length;
+            int pruned_knitting = test_case.solve<KnittingState>(true, search).path_length;
+            int unpruned = test_case.solve<KnittingStateLM21>(true, search, false).path_length;
+            int unpruned_knitting = test_case.solve<KnittingState>(true, search, false).path_length;
+            if (pruned != unpruned || pruned_knitting != unpruned_knitting) {
+                std::cout << "error: pruned path length " << i << " = " << pruned << ", "
+                          << pruned_knitting << " (unpruned " << unpruned << ", "
+                          << unpruned_knitting << ")\n";
+            }
+        }
+    }
+
+    // make takes each transition in place and unmake reverts it, so
+    // ida_star, which searches that way, finds optimal, valid plans
+    {
+        std::mt19937 rng(11);
+        for (int i = 0; i < 4; i++) {
+            TestCase test_case = simple_tube(KnittingMachine(8, -3, 3), 6, 2, rng);
+            KnittingStateLM21 target = test_case.target_state<KnittingStateLM21>();
+            KnittingStateLM21 source = test_case.source_state<KnittingStateLM21>(&target);
+            KnittingStateLM21 state = source;
+            KnittingStateLM21::Undo undo;
+            for (auto it = source.canonical_adjacent(); it.has_next(); ) {
+                bool made = state.make(it.action, true, undo);
+                if (!made || state != it.next) {
+                    std::cout << "error: make " << i << " " << it.action.command() << "\n";
+                }
+                state.unmake(undo);
+                if (state != source) {
+                    std::cout << "error: unmake " << i << " " << it.action.command() << "\n";
+                }
+            }
+
+            int opt = test_case.test<KnittingStateLM21>(true, heuristics::Log()).path_length;
+            auto result = test_case.solve<KnittingStateLM21>(true,
+                [](const auto& sources, const auto& target, auto adj) {
+                    return search::ida_star(sources, target, adj, heuristics::Log());
+                }
+            );
+            if (result.path_length != opt) {
+                std::cout << "error: ida_star " << i << " = " << result.path_length << "\n";
+            }
+            if (!plan_is_valid(test_case, Plan(result))) {
+                std::cout << "error: ida_star plan " << i << " is invalid\n";
+            }
+        }
+    }
+
+    // the same holds for KnittingState
+    {
+        std::mt19937 rng(12);
+        for (int i = 0; i < 4; i++) {
+            TestCase test_case = flat_lace(KnittingMachine(7, -3, 3), 5, 3, rng);
+            KnittingState target = test_case.target_state<KnittingState>();
+            KnittingState source = test_case.source_state<KnittingState>(&target);
+            KnittingState state = source;
+            KnittingState::Undo undo;
+            for (auto it = source.canonical_adjacent(); it.has_next(); ) {
+                bool made = state.make(it.action, true, undo);
+                if (!made || state != it.next) {
+                    std::cout << "error: KnittingState::make " << i << " " << it.action.command() << "\n";
+                }
+                state.unmake(undo);
+                if (state != source) {
+                    std::cout << "error: KnittingState::unmake " << i << " " << it.action.command() << "\n";
+                }
+            }
+
+            int opt = test_case.test<KnittingState>(true, heuristics::Log()).path_length;
+            int ida = test_case.solve<KnittingState>(true,
+                [](const auto& sources, const auto& target, auto adj) {
+                    return search::ida_star(sources, target, adj, heuristics::Log());
+                }
+            ).path_length;
+            if (ida != opt) {
+                std::cout << "error: ida_star " << i << " for KnittingState = " << ida << "\n";
+            }
+        }
+    }
+
+    // the offsets kept up to date by transfers, canonicalize and make and
+    // unmake are the ones decode computes from scratch, for random walks
+    {
+        auto check_offsets = [](auto source, unsigned int seed, const std::string& name) {
+            using State = decltype(source);
+            auto rebuilt = [](const State& state) {
+                State copy = state;
+                copy.decode(state.encode());
+                return copy.offsets();
+            };
+            std::mt19937 rng(seed);
+            State state = source;
+            typename State::Undo undo;
+            for (int step = 0; step < 20; step++) {
+                std::vector<search::Successor<State>> successors;
+                for (auto it = state.adjacent(); it.has_next(); ) {
+                    successors.push_back(search::Successor<State> { it.next, it.action, it.weight });
+                }
+                if (successors.empty()) {
+                    break;
+                }
+                const auto& successor = successors[rng() % successors.size()];
+                State canonical = successor.next;
+                canonical.canonicalize();
+                State made = state;
+                bool agree = successor.next.offsets() == rebuilt(successor.next) &&
+                             canonical.offsets() == rebuilt(canonical);
+                if (made.make(successor.action, true, undo)) {
+                    agree = agree && made.offsets() == rebuilt(made);
+                }
+                made.unmake(undo);
+                if (!agree || made.offsets() != state.offsets()) {
+                    std::cout << "error: " << name << " offsets differ at step " << step << "\n";
+                    return;
+                }
+                state = successor.next;
+            }
+        };
+
+        std::mt19937 rng(14);
+        for (unsigned int i = 0; i < 3; i++) {
+            TestCase flat = flat_lace(KnittingMachine(7, -3, 3), 5, 3, rng);
+            KnittingState target = flat.target_state<KnittingState>();
+            check_offsets(flat.source_state<KnittingState>(&target), i, "KnittingState");
+            TestCase tube = simple_tube(KnittingMachine(8, -3, 3), 6, 2, rng);
+            KnittingStateLM21 tube_target = tube.target_state<KnittingStateLM21>();
+            check_offsets(tube.source_state<KnittingStateLM21>(&tube_target), i, "KnittingStateLM21");
+        }
+    }
+
+    // a batch rethrows a job's exception only once the other jobs, which
+    // share its locals, have finished
+    {
+        std::mt19937 rng(13);
+        std::vector<TestCase> test_cases;
+        for (int i = 0; i < 6; i++) {
+            test_cases.push_back(flat_lace(KnittingMachine(5, -2, 2), 3, 2, rng));
+        }
+        std::atomic<int> finished = 0;
+        try {
+            batch::plan<KnittingStateLM21>(test_cases, [&](const TestCase& test_case) {
+                if (&test_case == &test_cases[0]) {
+                    throw InvalidTestCaseException();
+                }
+                auto result = test_case.test<KnittingStateLM21>(true, heuristics::Log());
+                finished++;
+                return result;
+            }, 2);
+            std::cout << "error: batch::plan did not rethrow\n";
+        }
+        catch (const InvalidTestCaseException&) {
+            if (finished != 5) {
+                std::cout << "error: batch::plan rethrew with " << finished << " jobs finished\n";
+            }
+        }
+    }
+
     return 0;
 }
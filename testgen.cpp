@@ -1,5 +1,10 @@
 #include "testgen.h"
 #include "cbraid.h"
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+#include <tuple>
 
 
 namespace knitting {
@@ -50,89 +55,467 @@ TestCase::TestCase(const TestCase& other) :
     target_needle_count(other.target_needle_count)
 { }
 
-search::SearchResult<KnittingState> TestCase::test(
-    bool canonicalize, unsigned int (KnittingState::*h)() const
-) {
-    machine.racking = target_racking;
-    KnittingState target(
-        machine, target_back_needles, target_front_needles,
-        CBraid::ArtinBraid(target_needle_count), slack_constraints
-    );
-    machine.racking = 0;
-    KnittingState source(
-        machine, source_back_needles, source_front_needles,
-        source_braid, slack_constraints, &target
-    );
+const KnittingMachine& TestCase::knitting_machine() const {
+    return machine;
+}
+
+char TestCase::first_needle() const {
+    for (char i = 0; i < machine.width; i++) {
+        if (
+            source_back_needles[i] > 0 || source_front_needles[i] > 0 ||
+            target_back_needles[i] > 0 || target_front_needles[i] > 0
+        ) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-    if (canonicalize) {
-        return search::a_star(
-            source.all_canonical_rackings(), target,
-            &KnittingState::canonical_adjacent, h
+char TestCase::last_needle() const {
+    for (char i = (char)(machine.width - 1); i >= 0; i--) {
+        if (
+            source_back_needles[i] > 0 || source_front_needles[i] > 0 ||
+            target_back_needles[i] > 0 || target_front_needles[i] > 0
+        ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+TestCase TestCase::shifted(int shift, char width) const {
+    auto shift_bed = [shift, width](const std::vector<char>& bed) {
+        std::vector<char> shifted_bed(width, 0);
+        for (int i = 0; i < (int)bed.size(); i++) {
+            if (bed[i] > 0) {
+                shifted_bed.at(i + shift) = bed[i];
+            }
+        }
+        return shifted_bed;
+    };
+
+    std::vector<SlackConstraint> shifted_constraints;
+    for (const auto& constraint : slack_constraints) {
+        shifted_constraints.emplace_back(
+            NeedleLabel(constraint.needle_1.front, (char)(constraint.needle_1.i + shift)),
+            NeedleLabel(constraint.needle_2.front, (char)(constraint.needle_2.i + shift)),
+            constraint.limit
         );
     }
-    else {
-        return search::a_star(
-            source.all_rackings(), target,
-            &KnittingState::adjacent, h
+
+    return TestCase(
+        KnittingMachine(width, machine.min_racking, machine.max_racking),
+        shift_bed(source_back_needles),
+        shift_bed(source_front_needles),
+        shift_bed(target_back_needles),
+        shift_bed(target_front_needles),
+        source_braid,
+        shifted_constraints,
+        target_racking
+    );
+}
+
+TestCase TestCase::normalized(int margin, int& shift) const {
+    int first = first_needle();
+    int last = last_needle();
+
+    if (first < 0) {
+        shift = 0;
+        return *this;
+    }
+
+    // Canonicalizing depends on which needles face each other, so the bed
+    // keeps the largest racking's worth of needles on each side of the
+    // loops, where it has them, for plans to replay the same on this bed.
+    int max_racking = std::max<int>(machine.max_racking, -machine.min_racking);
+    int room = std::max(margin, max_racking);
+    int left = std::min(first, room);
+    int right = std::min(machine.width - 1 - last, room);
+
+    // the bed must stay wider than the largest racking; the original bed
+    // is, so this terminates
+    int min_width = max_racking + 1;
+    while (last - first + 1 + left + right < min_width) {
+        if (left < first) {
+            left++;
+        }
+        else {
+            right++;
+        }
+    }
+
+    shift = first - left;
+    return shifted(-shift, (char)(last - first + 1 + left + right));
+}
+
+std::vector<NeedleLabel> TestCase::loop_needles(bool target) const {
+    KnittingMachine racked = machine;
+    racked.racking = target ? target_racking : 0;
+    const std::vector<char>& back_needles = target ? target_back_needles : source_back_needles;
+    const std::vector<char>& front_needles = target ? target_front_needles : source_front_needles;
+
+    std::vector<NeedleLabel> needles;
+    for (int i = 0; i < 2*machine.width; i++) {
+        NeedleLabel needle = racked[i];
+        char count = (needle.front ? front_needles : back_needles)[needle.i];
+        needles.insert(needles.end(), count, needle);
+    }
+    return needles;
+}
+
+std::vector<std::pair<char, char>> TestCase::windows(int padding) const {
+    if (!source_braid.CompareWithIdentity()) {
+        return { { 0, (char)(machine.width - 1) } };
+    }
+
+    auto sources = loop_needles(false);
+    auto targets = loop_needles(true);
+
+    std::vector<std::pair<int, int>> intervals;
+    for (std::size_t k = 0; k < sources.size(); k++) {
+        int location = sources[k].location(0);
+        int target_location = targets[k].location(target_racking);
+        if (sources[k] == targets[k] && location == target_location) {
+            continue;
+        }
+
+        intervals.emplace_back(
+            std::min(location, target_location) - padding,
+            std::max(location, target_location) + padding
         );
     }
+    std::sort(intervals.begin(), intervals.end());
+
+    std::vector<std::pair<char, char>> ranges;
+    for (auto [first, last] : intervals) {
+        first = std::max(first, 0);
+        last = std::min(last, machine.width - 1);
+
+        if (!ranges.empty() && ranges.back().second >= first) {
+            ranges.back().second = (char)std::max<int>(last, ranges.back().second);
+        }
+        else {
+            ranges.emplace_back((char)first, (char)last);
+        }
+    }
+
+    return ranges;
 }
 
-search::SearchResult<KnittingState> TestCase::test_id(
-    bool canonicalize, unsigned int (KnittingState::*h)() const
-) {
-    machine.racking = target_racking;
-    KnittingState target(
-        machine, target_back_needles, target_front_needles,
-        CBraid::ArtinBraid(target_needle_count), slack_constraints
-    );
-    machine.racking = 0;
-    KnittingState source(
-        machine, source_back_needles, source_front_needles,
-        source_braid, slack_constraints, &target
+TestCase TestCase::window(
+    char first, char last, const std::vector<std::pair<char, char>>& done, int& shift
+) const {
+    if (first == 0 && last == machine.width - 1) {
+        shift = 0;
+        return *this;
+    }
+    if (!source_braid.CompareWithIdentity()) {
+        throw NotImplemented();
+    }
+
+    auto sources = loop_needles(false);
+    auto targets = loop_needles(true);
+
+    // the loops nearest to the window on either side stay put
+    std::vector<NeedleLabel> current(sources.size());
+    int lo = first;
+    int hi = last;
+    for (std::size_t k = 0; k < sources.size(); k++) {
+        bool moved = std::any_of(done.begin(), done.end(), [&](auto range) {
+            return sources[k].i >= range.first && sources[k].i <= range.second;
+        });
+        current[k] = moved ? targets[k] : sources[k];
+        if (current[k].i < first) {
+            lo = lo == first ? current[k].i : std::max<int>(lo, current[k].i);
+        }
+        if (current[k].i > last) {
+            hi = hi == last ? current[k].i : std::min<int>(hi, current[k].i);
+        }
+    }
+
+    char width = (char)(hi - lo + 1);
+    std::vector<char> source_back(width, 0);
+    std::vector<char> source_front(width, 0);
+    std::vector<char> target_back(width, 0);
+    std::vector<char> target_front(width, 0);
+    int loop_count = 0;
+
+    for (std::size_t k = 0; k < sources.size(); k++) {
+        NeedleLabel needle = current[k];
+        if (needle.i < lo || needle.i > hi) {
+            continue;
+        }
+        NeedleLabel target = needle.i < first || needle.i > last ? needle : targets[k];
+
+        (needle.front ? source_front : source_back)[needle.i - lo]++;
+        (target.front ? target_front : target_back)[target.i - lo]++;
+        loop_count++;
+    }
+
+    std::vector<SlackConstraint> window_constraints;
+    for (const auto& constraint : slack_constraints) {
+        auto loop = [&sources](NeedleLabel needle) {
+            auto it = std::find(sources.begin(), sources.end(), needle);
+            if (it == sources.end()) {
+                // constrains a needle with no loops
+                throw InvalidTestCaseException();
+            }
+            return it - sources.begin();
+        };
+        NeedleLabel needle_1 = current[loop(constraint.needle_1)];
+        NeedleLabel needle_2 = current[loop(constraint.needle_2)];
+
+        if (needle_1.i >= lo && needle_1.i <= hi && needle_2.i >= lo && needle_2.i <= hi) {
+            window_constraints.emplace_back(
+                NeedleLabel(needle_1.front, (char)(needle_1.i - lo)),
+                NeedleLabel(needle_2.front, (char)(needle_2.i - lo)),
+                constraint.limit
+            );
+        }
+    }
+
+    // rackings beyond the window width only move needles off the window
+    char min_racking = std::min(target_racking, std::max(machine.min_racking, (char)(1 - width)));
+    char max_racking = std::max(target_racking, std::min(machine.max_racking, (char)(width - 1)));
+
+    shift = lo;
+    return TestCase(
+        KnittingMachine(width, min_racking, max_racking),
+        source_back,
+        source_front,
+        target_back,
+        target_front,
+        CBraid::ArtinBraid(loop_count),
+        window_constraints,
+        target_racking
     );
+}
 
-    if (canonicalize) {
-        return search::ida_star(
-            source.all_canonical_rackings(), target,
-            &KnittingState::canonical_adjacent, h
-        );
+std::string TestCase::key() const {
+    std::ostringstream o;
+
+    o << (int)machine.width << " " << (int)machine.min_racking << " "
+      << (int)machine.max_racking << " " << (int)target_racking << ";";
+
+    for (const auto* bed : {
+        &source_back_needles, &source_front_needles,
+        &target_back_needles, &target_front_needles
+    }) {
+        for (char x : *bed) {
+            o << " " << (int)x;
+        }
+        o << ";";
     }
-    else {
-        return search::ida_star(
-            source.all_rackings(), target,
-            &KnittingState::adjacent, h
-        );
+
+    cb::ArtinBraid braid = source_braid;
+    braid.MakeLCF();
+    o << " " << braid.Index() << " " << braid.LeftDelta;
+    for (const auto& factor : braid.FactorList) {
+        o << " |";
+        for (int i = 1; i <= braid.Index(); i++) {
+            o << " " << factor[i];
+        }
+    }
+    o << ";";
+
+    std::vector<SlackConstraint> ordered;
+    for (const auto& constraint : slack_constraints) {
+        if (constraint.needle_1.id() <= constraint.needle_2.id()) {
+            ordered.push_back(constraint);
+        }
+        else {
+            ordered.emplace_back(constraint.needle_2, constraint.needle_1, constraint.limit);
+        }
     }
+    std::sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b) {
+        return std::tuple(a.needle_1.id(), a.needle_2.id(), a.limit) <
+               std::tuple(b.needle_1.id(), b.needle_2.id(), b.limit);
+    });
+    for (const auto& constraint : ordered) {
+        o << " " << constraint.needle_1 << " " << constraint.needle_2 << " "
+          << (int)constraint.limit << ",";
+    }
+
+    return o.str();
 }
 
-search::SearchResult<KnittingStateLM21> TestCase::test(
-    bool canonicalize, unsigned int (KnittingStateLM21::*h)() const
-) {
-    machine.racking = target_racking;
-    KnittingStateLM21 target(
-        machine, target_back_needles, target_front_needles,
+TestCase TestCase::parse(const std::string& key) {
+    std::vector<std::string> fields;
+    std::istringstream in(key);
+    for (std::string field; std::getline(in, field, ';');) {
+        fields.push_back(field);
+    }
+    if (fields.size() == 6) {
+        // no slack constraints
+        fields.emplace_back();
+    }
+    if (fields.size() != 7) {
+        throw InvalidTestCaseException();
+    }
+
+    int width, min_racking, max_racking, target_racking;
+    std::istringstream header(fields[0]);
+    if (
+        !(header >> width >> min_racking >> max_racking >> target_racking) ||
+        width < 1 || width > std::numeric_limits<char>::max() ||
+        min_racking <= -width || max_racking >= width ||
+        target_racking < min_racking || target_racking > max_racking
+    ) {
+        throw InvalidTestCaseException();
+    }
+    KnittingMachine machine((char)width, (char)min_racking, (char)max_racking);
+
+    std::vector<std::vector<char>> beds;
+    std::vector<int> loop_counts;
+    for (int b = 1; b <= 4; b++) {
+        std::istringstream bed_in(fields[b]);
+        beds.emplace_back();
+        int x, loops = 0;
+        while (bed_in >> x) {
+            if (x < 0 || x > 64) {
+                throw InvalidTestCaseException();
+            }
+            beds.back().push_back((char)x);
+            loops += x;
+        }
+        if (!bed_in.eof() || beds.back().size() != (std::size_t)width) {
+            throw InvalidTestCaseException();
+        }
+        loop_counts.push_back(loops);
+    }
+    int loop_count = loop_counts[0] + loop_counts[1];
+    if (loop_count < 1 || loop_count != loop_counts[2] + loop_counts[3]) {
+        throw InvalidTestCaseException();
+    }
+
+    // Delta^left_delta followed by the factors, each as a permutation
+    std::istringstream braid_in(fields[5]);
+    int index, left_delta;
+    if (!(braid_in >> index >> left_delta) || index != loop_count) {
+        throw InvalidTestCaseException();
+    }
+    std::vector<cb::ArtinFactor> factors;
+    std::string bar;
+    while (braid_in >> bar) {
+        if (bar != "|") {
+            throw InvalidTestCaseException();
+        }
+        cb::ArtinFactor factor(index, cb::ArtinFactor::Uninitialize);
+        std::vector<bool> seen(index + 1, false);
+        for (int i = 1; i <= index; i++) {
+            int x;
+            if (!(braid_in >> x) || x < 1 || x > index || seen[x]) {
+                throw InvalidTestCaseException();
+            }
+            seen[x] = true;
+            factor[i] = x;
+        }
+        factors.push_back(factor);
+    }
+    cb::ArtinBraid braid = make_braid(index, left_delta, factors);
+
+    // needle_1 needle_2 limit, for each constraint
+    std::vector<SlackConstraint> slack_constraints;
+    std::istringstream constraints_in(fields[6]);
+    std::string constraint;
+    while (std::getline(constraints_in, constraint, ',')) {
+        std::istringstream constraint_in(constraint);
+        std::string needles[2];
+        int limit;
+        if (!(constraint_in >> needles[0])) {
+            // trailing separator
+            continue;
+        }
+        if (!(constraint_in >> needles[1] >> limit) || limit < 0 || limit > 127) {
+            throw InvalidTestCaseException();
+        }
+
+        NeedleLabel labels[2];
+        for (int k = 0; k < 2; k++) {
+            const std::string& needle = needles[k];
+            if (
+                needle.size() < 2 || (needle[0] != 'f' && needle[0] != 'b') ||
+                needle.find_first_not_of("0123456789", 1) != std::string::npos
+            ) {
+                throw InvalidTestCaseException();
+            }
+            int i = std::stoi(needle.substr(1));
+            bool front = needle[0] == 'f';
+            if (i >= width || beds[front ? 1 : 0][i] == 0) {
+                // constraints connect source loops
+                throw InvalidTestCaseException();
+            }
+            labels[k] = NeedleLabel(front, (char)i);
+        }
+        slack_constraints.emplace_back(labels[0], labels[1], (char)limit);
+    }
+
+    return TestCase(
+        machine, beds[0], beds[1], beds[2], beds[3],
+        braid, slack_constraints, (char)target_racking
+    );
+}
+
+template <>
+KnittingState TestCase::target_state<KnittingState>() const {
+    KnittingMachine target_machine = machine;
+    target_machine.racking = target_racking;
+    return KnittingState(
+        target_machine, target_back_needles, target_front_needles,
+        CBraid::ArtinBraid(target_needle_count), slack_constraints
+    );
+}
+
+template <>
+KnittingState TestCase::source_state<KnittingState>(KnittingState* target) const {
+    KnittingMachine source_machine = machine;
+    source_machine.racking = 0;
+    return KnittingState(
+        source_machine, source_back_needles, source_front_needles,
+        source_braid, slack_constraints, target
+    );
+}
+
+template <>
+KnittingStateLM21 TestCase::target_state<KnittingStateLM21>() const {
+    KnittingMachine target_machine = machine;
+    target_machine.racking = target_racking;
+    return KnittingStateLM21(
+        target_machine, target_back_needles, target_front_needles,
         CBraid::ArtinBraid(source_braid.Index()), slack_constraints
     );
-    machine.racking = 0;
-    KnittingStateLM21 source(
-        machine, source_back_needles, source_front_needles,
-        source_braid, slack_constraints, &target
+}
+
+template <>
+KnittingStateLM21 TestCase::source_state<KnittingStateLM21>(KnittingStateLM21* target) const {
+    KnittingMachine source_machine = machine;
+    source_machine.racking = 0;
+    return KnittingStateLM21(
+        source_machine, source_back_needles, source_front_needles,
+        source_braid, slack_constraints, target
     );
+}
 
-    if (canonicalize) {
-        return search::a_star(
-            source.all_canonical_rackings(), target,
-            &KnittingStateLM21::canonical_adjacent, h
-        );
-    }
-    else {
-        return search::a_star(
-            source.all_rackings(), target,
-            &KnittingStateLM21::adjacent, h
-        );
-    }
+search::SearchResult<KnittingState> TestCase::test(
+    bool canonicalize, unsigned int (KnittingState::*h)() const
+) const {
+    return test<KnittingState>(canonicalize, h);
+}
+
+search::SearchResult<KnittingState> TestCase::test_id(
+    bool canonicalize, unsigned int (KnittingState::*h)() const
+) const {
+    return solve<KnittingState>(canonicalize, [h](const auto& sources, const auto& target, auto adj) {
+        return search::ida_star(sources, target, adj, h);
+    });
 }
+
+search::SearchResult<KnittingStateLM21> TestCase::test(
+    bool canonicalize, unsigned int (KnittingStateLM21::*h)() const
+) const {
+    return test<KnittingStateLM21>(canonicalize, h);
+}
+
 std::ostream& operator<<(std::ostream& o, const knitting::TestCase& state) {
     KnittingMachine machine = state.machine;
     machine.racking = state.target_racking;
@@ -209,6 +592,67 @@ TestCase flat_lace (KnittingMachine machine, int loop_count, int max_stack, std:
     );
 }
 
+// Independent flat_lace patterns of pattern_width needles side by side,
+// separated by single columns of loops that stay in place.
+TestCase flat_lace_panel (
+    KnittingMachine machine, int pattern_width, int loop_count, int max_stack, std::mt19937& rng
+) {
+    KnittingMachine pattern_machine(
+        (char)pattern_width,
+        std::max(machine.min_racking, (char)(1 - pattern_width)),
+        std::min(machine.max_racking, (char)(pattern_width - 1))
+    );
+
+    std::vector<char> empty_bed(machine.width, 0);
+    std::vector<char> source_bed;
+    std::vector<char> target_bed;
+
+    for (int first = 0; first + pattern_width <= machine.width; first += pattern_width + 1) {
+        auto source = flat_bed(pattern_machine, loop_count, 1, rng);
+        auto target = flat_bed(pattern_machine, loop_count, max_stack, rng);
+        source_bed.insert(source_bed.end(), source.begin(), source.end());
+        target_bed.insert(target_bed.end(), target.begin(), target.end());
+
+        // a plain column between patterns
+        source_bed.push_back(1);
+        target_bed.push_back(1);
+    }
+    source_bed.resize(machine.width, 0);
+    target_bed.resize(machine.width, 0);
+
+    // loop k moves from source_locations[k] to target_locations[k]
+    std::vector<char> source_locations;
+    std::vector<char> target_locations;
+    for (char i = 0; i < machine.width; i++) {
+        source_locations.insert(source_locations.end(), source_bed[i], i);
+        target_locations.insert(target_locations.end(), target_bed[i], i);
+    }
+
+    // the yarn next to a column is long enough for the source and target
+    std::vector<SlackConstraint> slack_constraints;
+    for (std::size_t k = 1; k < source_locations.size(); k++) {
+        slack_constraints.emplace_back(
+            NeedleLabel(true, source_locations[k-1]),
+            NeedleLabel(true, source_locations[k]),
+            std::max({
+                2,
+                source_locations[k] - source_locations[k-1],
+                target_locations[k] - target_locations[k-1]
+            })
+        );
+    }
+
+    return TestCase(
+        machine,
+        empty_bed,
+        source_bed,
+        empty_bed,
+        target_bed,
+        CBraid::ArtinBraid((int)source_locations.size()),
+        slack_constraints
+    );
+}
+
 TestCase simple_tube (
     KnittingMachine machine, int loop_count, int pass_count, std::mt19937& rng
 ) {
@@ -1,5 +1,8 @@
 #include <random>
+#include <string>
+#include <utility>
 #include "search.h"
+#include "heuristics.h"
 #include "knitting.h"
 #include "cbraid.h"
 #include "util.h"
@@ -9,6 +12,8 @@
 
 namespace knitting {
 
+class InvalidTestCaseException { };
+
 class TestCase {
 
     KnittingMachine machine;
@@ -21,6 +26,10 @@ class TestCase {
     char target_racking;
     int target_needle_count;
 
+    // the needle of every source or target loop, in order along the bed;
+    // with a trivial braid, the k-th source loop goes to the k-th target
+    std::vector<NeedleLabel> loop_needles(bool target) const;
+
 public:
     TestCase(
         const KnittingMachine,
@@ -34,18 +43,102 @@ public:
     );
     TestCase(const TestCase&);
 
+    const KnittingMachine& knitting_machine() const;
+
+    // leftmost/rightmost needle holding a source or target loop on either
+    // bed, or -1 if there are no loops
+    char first_needle() const;
+    char last_needle() const;
+
+    // the same problem with every loop moved `shift` needles to the right,
+    // on a bed of the given width
+    TestCase shifted(int shift, char width) const;
+
+    // the same problem moved so that at most `margin` empty needles, or as
+    // many as the largest racking if that is more, remain on either side of
+    // the loops; plans for it map back to this problem by adding `shift` to
+    // every needle index. With margin >= the bed width, the two problems
+    // are equivalent.
+    TestCase normalized(int margin, int& shift) const;
+
+    // Needle ranges, padded by `padding` needles, that together contain
+    // every loop that has to move and its destination. The ranges do not
+    // overlap; ranges that would are merged. Without a
+    // trivial source braid, the strands may cross between any two loops,
+    // so the whole bed is a single range.
+    std::vector<std::pair<char, char>> windows(int padding) const;
+
+    // The part of the problem on needles first to last, a range containing
+    // every loop it moves and their destinations (see windows), after the
+    // loops in the done ranges have reached their targets. The nearest
+    // needle with loops on either side is included, so slack constraints to
+    // it still hold as long as its loops aren't moved. Plans for it map back
+    // to this problem by adding `shift` to every needle index. Requires a
+    // trivial source braid unless the window is the whole bed. Throws
+    // InvalidTestCaseException if a constraint names a needle with no loops.
+    TestCase window(
+        char first, char last, const std::vector<std::pair<char, char>>& done, int& shift
+    ) const;
+
+    // a canonical description of the problem, with the source braid in
+    // left canonical form and the slack constraints in a fixed order
+    std::string key() const;
+    // the problem described by a key; throws InvalidTestCaseException
+    static TestCase parse(const std::string&);
 
-    search::SearchResult<KnittingState> test(bool, unsigned int (KnittingState::*h)() const);
-    search::SearchResult<KnittingState> test_id(bool, unsigned int (KnittingState::*h)() const);
+    template <typename State>
+    State target_state() const;
+    template <typename State>
+    State source_state(State*) const;
+
+    // Calls search(sources, target, adj) on this test case and returns its
+    // result, where adj expands states canonically iff canonicalize is set,
+    // skipping dominated transfer combinations unless prune is false.
+    template <typename State, typename Search>
+    auto solve(bool canonicalize, Search search, bool prune = true) const {
+        State target = target_state<State>();
+        State source = source_state<State>(&target);
+
+        if (canonicalize) {
+            return search(
+                source.all_canonical_rackings(), target, heuristics::CanonicalAdjacent { prune }
+            );
+        }
+        else {
+            return search(source.all_rackings(), target, heuristics::Adjacent());
+        }
+    }
+
+    template <typename State, typename H>
+    search::SearchResult<State> test(bool canonicalize, H h) const {
+        return solve<State>(canonicalize, [&h](const auto& sources, const auto& target, auto adj) {
+            return search::a_star(sources, target, adj, h);
+        });
+    }
+
+    search::SearchResult<KnittingState> test(bool, unsigned int (KnittingState::*h)() const) const;
+    search::SearchResult<KnittingState> test_id(
+        bool, unsigned int (KnittingState::*h)() const
+    ) const;
     search::SearchResult<KnittingStateLM21> test(
         bool, unsigned int (KnittingStateLM21::*h)() const
-    );
+    ) const;
 
     friend std::ostream& operator<<(std::ostream&, const TestCase&);
 };
 
+template <>
+KnittingState TestCase::target_state<KnittingState>() const;
+template <>
+KnittingState TestCase::source_state<KnittingState>(KnittingState*) const;
+template <>
+KnittingStateLM21 TestCase::target_state<KnittingStateLM21>() const;
+template <>
+KnittingStateLM21 TestCase::source_state<KnittingStateLM21>(KnittingStateLM21*) const;
+
 TestCase flat_lace (KnittingMachine, int, int, std::mt19937&);
 TestCase simple_tube (KnittingMachine, int, int, std::mt19937&);
+TestCase flat_lace_panel (KnittingMachine, int, int, int, std::mt19937&);
 
 class ResultAggregate {
 public:
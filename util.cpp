@@ -1,4 +1,5 @@
 #include "util.h"
+#include <algorithm>
 #include <bit>
 
 
@@ -14,6 +15,44 @@ double StopWatch::stop() {
     ).count();
 }
 
+ThreadPool::ThreadPool(unsigned int threads) {
+    for (unsigned int i = 0; i < std::max(threads, 1u); i++) {
+        workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+unsigned int ThreadPool::size() const {
+    return (unsigned int)workers.size();
+}
+void ThreadPool::cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.clear();
+}
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (jobs.empty()) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
 unsigned int log_offsets(unsigned long long offsets) {
     int n = std::popcount(offsets);
 
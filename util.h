@@ -1,5 +1,14 @@
 #include <cstddef>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #ifndef UTIL_H
 #define UTIL_H
@@ -20,6 +29,42 @@ public:
     double stop();
 };
 
+// A fixed set of worker threads running submitted jobs in FIFO order.
+// The destructor finishes all submitted jobs before joining, unless they
+// are cancelled.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void work();
+
+public:
+    ThreadPool(unsigned int = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    unsigned int size() const;
+    // Drops the jobs not yet started, so that destroying the pool only
+    // waits for those running; the futures of dropped jobs throw
+    // std::future_error (broken_promise).
+    void cancel();
+
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F f) {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(f));
+        auto future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.emplace_back([task]() { (*task)(); });
+        }
+        cv.notify_one();
+        return future;
+    }
+};
+
 unsigned int log_offsets(unsigned long long);
 
 #endif
@@ -0,0 +1,106 @@
+#include "windowed.h"
+#include <algorithm>
+#include <sstream>
+
+namespace windowed {
+
+WindowedPlan::WindowedPlan(
+    const Plan& plan, std::size_t window_count, std::size_t search_tree_size, double seconds_taken
+) :
+    plan(plan),
+    window_count(window_count),
+    search_tree_size(search_tree_size),
+    seconds_taken(seconds_taken)
+{ }
+
+Plan stitch(const std::vector<Plan>& plans) {
+    int path_length = 0;
+    std::vector<std::string> commands;
+
+    for (const Plan& plan : plans) {
+        path_length += plan.path_length;
+        commands.insert(commands.end(), plan.commands.begin(), plan.commands.end());
+    }
+
+    return Plan(path_length, plans.empty() ? 0 : plans.front().start_racking, commands);
+}
+
+// A plan as the rackings it visits, each with the transfers made there
+// before racking to the next one.
+static std::vector<std::pair<int, std::string>> passes(const Plan& plan) {
+    std::vector<std::pair<int, std::string>> elements;
+    int racking = plan.start_racking;
+
+    for (const std::string& command : plan.commands) {
+        std::istringstream in(command);
+        std::string word;
+        std::string xfers;
+        int next_racking = racking;
+
+        while (in >> word) {
+            if (word == "rack") {
+                in >> next_racking;
+            }
+            else if ((word[0] == 'f' || word[0] == 'b') && word.size() > 1) {
+                if (!xfers.empty()) {
+                    xfers += ' ';
+                }
+                xfers += word.substr(0, word.find(';'));
+            }
+        }
+
+        elements.emplace_back(racking, xfers);
+        racking = next_racking;
+    }
+    elements.emplace_back(racking, "");
+
+    return elements;
+}
+
+Plan merge(const std::vector<Plan>& plans) {
+    // plans with the same rackings, in the order they first appear
+    std::vector<std::vector<std::pair<int, std::string>>> groups;
+    int extra_length = 0;
+
+    for (const Plan& plan : plans) {
+        auto elements = passes(plan);
+        extra_length += plan.path_length - (int)plan.commands.size();
+
+        auto same_rackings = [&elements](const auto& group) {
+            return std::equal(
+                group.begin(), group.end(), elements.begin(), elements.end(),
+                [](const auto& x, const auto& y) { return x.first == y.first; }
+            );
+        };
+        auto group = std::find_if(groups.begin(), groups.end(), same_rackings);
+
+        if (group == groups.end()) {
+            groups.push_back(elements);
+            continue;
+        }
+        for (std::size_t k = 0; k < elements.size(); k++) {
+            if (!(*group)[k].second.empty() && !elements[k].second.empty()) {
+                (*group)[k].second += ' ';
+            }
+            (*group)[k].second += elements[k].second;
+        }
+    }
+
+    std::vector<std::string> commands;
+    for (const auto& group : groups) {
+        for (std::size_t k = 0; k + 1 < group.size(); k++) {
+            commands.push_back(
+                "xfer " + (group[k].second.empty() ? "none" : group[k].second) +
+                "; rack " + std::to_string(group[k+1].first)
+            );
+        }
+    }
+
+    return Plan(
+        (int)commands.size() + extra_length,
+        (char)(groups.empty() ? 0 : groups.front().front().first),
+        commands
+    );
+}
+
+}
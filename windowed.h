@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "plan.h"
+#include "search.h"
+#include "testgen.h"
+#include "util.h"
+
+#ifndef WINDOWED_H
+#define WINDOWED_H
+
+namespace windowed {
+
+using knitting::Plan;
+
+class WindowedPlan {
+public:
+    const Plan plan;
+    // number of windows solved separately; 1 if the whole bed was solved
+    const std::size_t window_count;
+    const std::size_t search_tree_size;
+    const double seconds_taken;
+
+    WindowedPlan(const Plan&, std::size_t, std::size_t, double);
+};
+
+// Joins plans, already shifted to their windows, into one plan that runs
+// them one after another.
+Plan stitch(const std::vector<Plan>&);
+
+// Joins plans, already shifted to their windows, into one plan like
+// stitch, except that plans visiting the same sequence of rackings run side
+// by side, making all their transfers in the same passes. The windows must
+// not share needles.
+Plan merge(const std::vector<Plan>&);
+
+// The transitions of `It` that keep the loop counts of the given needles.
+template <typename State, typename It>
+class PinnedTransitions {
+private:
+    It it;
+    const std::vector<std::pair<knitting::NeedleLabel, char>>* pinned;
+
+public:
+    const int& weight;
+    const State& next;
+    const knitting::Action& action;
+
+    PinnedTransitions(It&& it, const std::vector<std::pair<knitting::NeedleLabel, char>>* pinned) :
+        it(std::move(it)),
+        pinned(pinned),
+        weight(this->it.weight),
+        next(this->it.next),
+        action(this->it.action)
+    { }
+    PinnedTransitions(const PinnedTransitions&) = delete;
+
+    bool has_next() {
+        while (it.has_next()) {
+            bool kept = std::all_of(pinned->begin(), pinned->end(), [this](const auto& needle) {
+                return it.next.loop_count(needle.first) == needle.second;
+            });
+            if (kept) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // see KnittingState::TransitionIterator::reset
+    void reset() {
+        it.reset();
+    }
+    bool canonicalizes() const {
+        return it.canonicalizes();
+    }
+
+    // see KnittingState::TransitionIterator::restrict
+    std::size_t combinations() const {
+        return it.combinations();
+    }
+    std::size_t max_transitions() const {
+        return it.max_transitions();
+    }
+    void restrict(std::size_t first, std::size_t count) {
+        it.restrict(first, count);
+    }
+};
+
+// Plans test_case by solving its windows (see TestCase::windows) with A*
+// and heuristic h, one at a time, each after the ones before it are done:
+// every time, the leftmost window that has a plan that also works on the
+// whole bed runs next. The loops a window includes from beyond its range
+// are not moved, so slack constraints that cross the window hold. Every
+// window after the first starts at the racking the previous one ended at,
+// which is the target racking, so the windows share one racking sequence.
+// If no window can run, the leftmost one left is merged with its nearest
+// neighbor and planning starts over. Finally, window plans with the same
+// rackings are run side by side instead (see merge) if that is still valid.
+// The plan is valid but not necessarily optimal.
+template <typename State, typename H>
+WindowedPlan plan(const knitting::TestCase& test_case, int padding, bool canonicalize, H h) {
+    StopWatch stop_watch;
+    std::size_t search_tree_size = 0;
+
+    auto windows = test_case.windows(padding);
+    std::unordered_map<std::string, Plan> window_plans;
+
+    auto window_plan = [&](std::pair<char, char> range, const std::vector<std::pair<char, char>>& done) {
+        int shift;
+        auto window = test_case.window(range.first, range.second, done, shift);
+
+        // only the first window may start at another racking
+        bool any_racking = done.empty();
+        std::string key = window.key() + (any_racking ? "any" : "");
+
+        auto found = window_plans.find(key);
+        if (found == window_plans.end()) {
+            auto result = window.template solve<State>(canonicalize,
+                [&](const auto& sources, const auto& target, auto adj) {
+                    std::vector<State> starts;
+                    for (const State& source : sources) {
+                        if (any_racking || source.racking() == target.racking()) {
+                            starts.push_back(source);
+                        }
+                    }
+
+                    std::vector<std::pair<knitting::NeedleLabel, char>> pinned;
+                    for (int i = window.first_needle(); i <= window.last_needle(); i++) {
+                        if (i >= range.first - shift && i <= range.second - shift) {
+                            continue;
+                        }
+                        for (bool front : { false, true }) {
+                            knitting::NeedleLabel needle(front, (char)i);
+                            pinned.emplace_back(needle, target.loop_count(needle));
+                        }
+                    }
+
+                    auto pinned_adj = [&adj, &pinned](const State& state) {
+                        return PinnedTransitions<State, decltype(std::invoke(adj, state))>(
+                            std::invoke(adj, state), &pinned
+                        );
+                    };
+                    return search::a_star(starts, target, pinned_adj, h);
+                }
+            );
+            search_tree_size += result.search_tree_size;
+            found = window_plans.emplace(key, Plan(result)).first;
+        }
+        return found->second.shifted(shift);
+    };
+
+    State target = test_case.target_state<State>();
+
+    while (true) {
+        State state = test_case.source_state<State>(&target);
+        std::vector<Plan> plans;
+        std::vector<std::pair<char, char>> done;
+        std::vector<std::pair<char, char>> remaining = windows;
+
+        bool progress = true;
+        while (!remaining.empty() && progress) {
+            progress = false;
+            for (std::size_t k = 0; k < remaining.size() && !progress; k++) {
+                Plan plan = window_plan(remaining[k], done);
+                State next = state;
+                if (
+                    plan.path_length >= 0 &&
+                    (!done.empty() || next.rack(plan.start_racking)) &&
+                    plan.apply(next, canonicalize)
+                ) {
+                    state = next;
+                    plans.push_back(plan);
+                    done.push_back(remaining[k]);
+                    remaining.erase(remaining.begin() + (long)k);
+                    progress = true;
+                }
+            }
+        }
+
+        if (remaining.empty() && state == target) {
+            Plan stitched = stitch(plans);
+            Plan merged = merge(plans);
+
+            State merged_state = test_case.source_state<State>(&target);
+            if (
+                merged.path_length < stitched.path_length &&
+                merged_state.rack(merged.start_racking) &&
+                merged.apply(merged_state, canonicalize) &&
+                merged_state == target
+            ) {
+                stitched = merged;
+            }
+            return WindowedPlan(stitched, windows.size(), search_tree_size, stop_watch.stop());
+        }
+        if (windows.size() <= 1) {
+            return WindowedPlan(Plan(-1, 0, {}), windows.size(), search_tree_size, stop_watch.stop());
+        }
+
+        // merge the leftmost window left with its nearest neighbor
+        std::size_t failed = remaining.empty() ? windows.size() - 1 :
+            (std::size_t)(std::find(windows.begin(), windows.end(), remaining.front()) - windows.begin());
+        std::size_t other;
+        if (failed == 0) {
+            other = 1;
+        }
+        else if (failed == windows.size() - 1) {
+            other = failed - 1;
+        }
+        else {
+            int left_gap = windows[failed].first - windows[failed-1].second;
+            int right_gap = windows[failed+1].first - windows[failed].second;
+            other = left_gap <= right_gap ? failed - 1 : failed + 1;
+        }
+
+        std::size_t left = std::min(failed, other);
+        windows[left].second = windows[left + 1].second;
+        windows.erase(windows.begin() + (long)left + 1);
+    }
+}
+
+}
+
+#endif